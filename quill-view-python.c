@@ -0,0 +1,237 @@
+/*
+	Copyright (c) 2008-2015 Mikael Strom
+
+	This file is part of quill-view.
+
+	quill-view-view is free software: you can redistribute it and/or modify
+	it under the terms of the GNU General Public License as published by
+	the Free Software Foundation, either version 3 of the License, or
+	(at your option) any later version.
+
+	This program is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+	GNU General Public License for more details.
+
+	You should have received a copy of the GNU General Public License
+	along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+	--------------------------------------------------------------------------------
+
+	Python module quillview, translating Quill documents in the Python
+	process, without running quill-view for each of them.
+
+		import quillview
+		text = quillview.translate(data)					# str
+		html = quillview.translate(data, "html")
+		data = quillview.translate(data, "text", "latin-1")	# bytes
+		info = quillview.info(data)							# dict
+
+	Threads translate documents in parallel. The converter keeps its state
+	for each thread (see PER_THREAD in quill-view.c), and the GIL is released
+	while translating, so a thread pool of them uses as many CPUs.
+
+	A damaged document raises ValueError, and so does a document that can't
+	be translated, for lack of memory say. The Python process goes on.
+
+	Build with "make python", which runs setup.py. POSIX only, the output is
+	collected with open_memstream().
+*/
+
+#define PY_SSIZE_T_CLEAN
+#include <Python.h>
+
+#define QV_NO_MAIN
+#define error quillError			/* not the error() of the C library, which ends the process */
+#include "quill-view.c"
+
+/*------------------------------------------------------------------------------- */
+/* Translate the document data to format, the output is returned in out. */
+/* error() comes back here rather than ending the Python process */
+bool translateMemory(char *data, Py_ssize_t size, Format fmt, char *name, char **out, size_t *outLen)
+{
+	static PER_THREAD FILE	*fp;	/* static, so still known after longjmp() */
+	char					*copy;
+	jmp_buf					here;
+
+	if(size > ARENA_MAX || (fp = open_memstream(out, outLen)) == NULL)
+		return false;
+
+	if(setjmp(here) != 0)
+	{
+		fclose(fp);
+		free(*out);
+		abandonDocument();
+		return false;
+	}
+	recovery = &here;
+
+	copy = arenaAlloc((unsigned) size + 1);
+	memcpy(copy, data, size);
+
+	if(! setDocument(copy, (unsigned) size))
+	{
+		fclose(fp);
+		free(*out);
+		abandonDocument();
+		return false;
+	}
+
+	rendererCount = 0;
+	addRenderer(fmt, fp);
+
+	renderDocument(name);
+
+	recovery = NULL;
+	fclose(fp);
+	unloadDocument();
+
+	return true;
+}
+
+/*------------------------------------------------------------------------------- */
+/* Decode the document data for info(), false if it is damaged */
+bool infoMemory(char *data, Py_ssize_t size, Header *h, LayoutTable *lt, int *paras)
+{
+	char	*copy;
+	bool	ok;
+	jmp_buf	here;
+
+	if(size > ARENA_MAX)
+		return false;
+
+	if(setjmp(here) != 0)
+	{
+		abandonDocument();
+		return false;
+	}
+	recovery = &here;
+
+	copy = arenaAlloc((unsigned) size + 1);
+	memcpy(copy, data, size);
+
+	ok = setDocument(copy, (unsigned) size);
+	*h = header;
+	*lt = layoutTable;
+	*paras = parTableHead.used;
+
+	recovery = NULL;
+	unloadDocument();
+
+	return ok;
+}
+
+/*------------------------------------------------------------------------------- */
+static PyObject *py_translate(PyObject *self, PyObject *args, PyObject *kwargs)
+{
+	static char	*keywords[] = { "data", "format", "encoding", "name", NULL };
+	char		*data;
+	Py_ssize_t	size;
+	char		*formatName = "text";
+	char		*encodingName = NULL;
+	char		*name = "(bytes)";
+	char		*out;
+	size_t		outLen;
+	Format		fmt;
+	bool		known;
+	bool		ok = false;
+	PyObject	*result;
+
+	if(! PyArg_ParseTupleAndKeywords(args, kwargs, "y#|zzs", keywords, &data, &size, &formatName, &encodingName, &name))
+		return NULL;
+
+	if(formatName == NULL || strcmp(formatName, "text") == 0)
+		fmt = Text;
+	else if(strcmp(formatName, "html") == 0)
+		fmt = Html;
+	else if(strcmp(formatName, "json") == 0)
+		fmt = Json;
+	else
+	{
+		PyErr_Format(PyExc_ValueError, "unknown format '%s', use text, html or json", formatName);
+		return NULL;
+	}
+
+	Py_BEGIN_ALLOW_THREADS
+	known = setEncoding(encodingName != NULL ? encodingName : "utf-8");
+	if(known)
+		ok = translateMemory(data, size, fmt, name, &out, &outLen);
+	Py_END_ALLOW_THREADS
+
+	if(! ok)
+	{
+		if(! known)
+			PyErr_Format(PyExc_ValueError, "unknown encoding '%s'", encodingName);
+		else
+			PyErr_SetString(PyExc_ValueError, "not a valid Quill document, or it can't be translated");
+		return NULL;
+	}
+
+	/* text in a chosen encoding is bytes, otherwise it is str, without the */
+	/* byte order mark of UTF-8 text */
+
+	if(encodingName != NULL && fmt == Text)
+		result = PyBytes_FromStringAndSize(out, outLen);
+	else if(fmt == Text && outLen >= 3 && memcmp(out, "\xEF\xBB\xBF", 3) == 0)
+		result = PyUnicode_DecodeUTF8(out + 3, outLen - 3, "replace");
+	else
+		result = PyUnicode_DecodeUTF8(out, outLen, "replace");
+
+	free(out);
+	return result;
+}
+
+/*------------------------------------------------------------------------------- */
+static PyObject *py_info(PyObject *self, PyObject *args)
+{
+	char		*data;
+	Py_ssize_t	size;
+	bool		ok;
+	Header		h;
+	LayoutTable	lt;
+	int			paras;
+
+	if(! PyArg_ParseTuple(args, "y#", &data, &size))
+		return NULL;
+
+	Py_BEGIN_ALLOW_THREADS
+	ok = infoMemory(data, size, &h, &lt, &paras);
+	Py_END_ALLOW_THREADS
+
+	if(! ok)
+	{
+		PyErr_SetString(PyExc_ValueError, "not a valid Quill document");
+		return NULL;
+	}
+
+	return Py_BuildValue("{s:I,s:I,s:I,s:I,s:i,s:i,s:i,s:i,s:i,s:i,s:i,s:i,s:i,s:i,s:i,s:i,s:i,s:i,s:i}",
+		"textLen", h.textLen, "paraLen", h.paraLen, "freeLen", h.freeLen, "layoutLen", h.layoutLen,
+		"paragraphs", paras,
+		"bottomMargin", lt.bottomMarg, "displayMode", lt.dispMode, "lineGap", lt.lineGap,
+		"pageLength", lt.pageLen, "startPage", lt.startPage, "colour", lt.color, "topMargin", lt.topMargin,
+		"wordCount", lt.wordCount, "headerAlign", lt.headerF, "footerAlign", lt.footerF,
+		"headerMargin", lt.headerMarg, "footerMargin", lt.footerMarg, "headerBold", lt.headerBold,
+		"footerBold", lt.footerBold);
+}
+
+/*------------------------------------------------------------------------------- */
+
+static PyMethodDef methods[] = {
+	{ "translate", (PyCFunction) py_translate, METH_VARARGS | METH_KEYWORDS,
+		"translate(data, format='text', encoding=None, name='(bytes)')\n\n"
+		"Translate a Quill document to text, html or json (JSON Lines). Returns\n"
+		"str, or bytes for text in the encoding given." },
+	{ "info", py_info, METH_VARARGS,
+		"info(data)\n\nThe file header and layout table of a Quill document, as a dict." },
+	{ NULL, NULL, 0, NULL }
+};
+
+static struct PyModuleDef module = {
+	PyModuleDef_HEAD_INIT, "quillview", "Translates Quill documents to Text, Html or JSON Lines.", -1, methods
+};
+
+/*------------------------------------------------------------------------------- */
+PyMODINIT_FUNC PyInit_quillview(void)
+{
+	return PyModule_Create(&module);
+}
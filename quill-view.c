@@ -18,7 +18,7 @@
 
 	--------------------------------------------------------------------------------
 
-	Quill-View - Translates Quill Documents to Text or Html.
+	Quill-View - Translates Quill Documents to Text, Html or JSON Lines.
 
 	Note: Must be compiled with default char UNSIGNED,
 		  or it will not work properly!
@@ -50,6 +50,40 @@
           this is for Xcode 6, hence x86 architecture only ;-(
           Email simon@studio.woden.com if you want a PPC version
 
+	- 0.8
+		* Full-text index over a set of documents, see --index and --query.
+		* Search documents directly with --grep, in parallel worker processes.
+		* Per document memory from an arena that is reused between documents.
+		* Several output formats from one translation, e.g. -t doc.txt -m doc.html
+		* Layout cache, see --cache, renders documents again without decoding them,
+		  and lays out only the paragraphs changed since when they are edited.
+		* Batch translation with --batch, reading ahead of the document translated.
+		* Linux: translate documents in a directory as they change, see --watch.
+		* Streamed translation in constant memory, see --stream.
+		* JSON Lines output, -j, a record per paragraph for bulk ingestion.
+		* Text in other encodings than UTF-8, see --encoding.
+		* Layout and rendering of a document side by side, see --pipeline.
+		* A file for each page, see --pages, rendered in parallel.
+		* Quick scan of the tables of many documents, see --info.
+		* Container of many documents, see --pack, mapped into memory by
+		  --batch and --info with --packed, instead of opening each.
+		* Paragraph by paragraph comparison of two documents, see --diff.
+		* Excerpts, see --paras, laid out without reading the text before.
+		* Documents with bad tab tables, or words wider than the margins, are
+		  laid out rather than hang. A batch can limit the work on each
+		  document, see --max-lines, --max-output and --max-time.
+		* Paragraph cache, see --para-cache, laying out paragraphs that are
+		  in many documents only once.
+		* Timeline of the work on each document, see --trace, for Chrome's
+		  trace viewer (chrome://tracing) or Perfetto.
+		* HTTP server of a directory of documents on localhost, see --http.
+		  Translations are kept in memory, compressed too when compiled
+		  with HAVE_ZLIB (and linked with -lz).
+		* Python module, see quill-view-python.c. Compile with QV_NO_MAIN to
+		  use the converter from other programs. Its state is kept for each
+		  thread, so threads translate documents side by side.
+		* Tests of the sample documents in tests/, run them with make check.
+
 	Todo's:
 	------
 
@@ -77,15 +111,45 @@
 #include <string.h>
 #include <ctype.h>
 #include <errno.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <setjmp.h>
+
+#if !defined(_WIN32) && !defined(_QDOS_)
+#ifndef HAVE_FORK
+#define HAVE_FORK						/* Python.h defines it too */
+#endif
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/wait.h>
+#include <dirent.h>
+#include <signal.h>
+#include <strings.h>
+#include <sys/time.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <sys/mman.h>
+#include <poll.h>
+#endif
+
+#ifdef HAVE_ZLIB
+#include <zlib.h>
+#endif
+
+#ifdef __linux__
+#include <sys/inotify.h>
+#endif
 
 /*------------------------------------------------------------------------------- */
 
-#define ME				"Quill-View 0.7 Beta"
+#define ME				"Quill-View 0.8"
+#define LAYOUT_VERSION	"layout format 1"	/* of layout cache files, bump it when the records or the layout change */
 
 #define true			1
 #define false			0
 
 #define	MAX_ARGV		5
+#define MAX_RENDERERS	4		/* Output formats from one translation */
 #define	END_TEXT		0x0e	/* End of text (EOF) */
 #define	END_PARA		0x00	/* End of Paragraph (resets highlighting attributes) */
 #define	SPACE			0x20	/* Space */
@@ -97,10 +161,69 @@
 #define	SUPER_SCRIPT	0x12	/* Superscript toggle */
 #define	SOFT_HYPEN		0x1e	/* Soft Hyphen */
 
+#define MAX_WORD		64		/* Longest word kept in the index, in characters */
+#define MAX_PATTERN		256		/* Longest search pattern, in characters */
+#define GREP_CONTEXT	30		/* Characters shown each side of a match */
+#define ARENA_BLOCK		65536	/* Smallest arena block */
+#define ARENA_LIMIT		16384	/* Default arena high-water mark, in kbytes */
+#define ARENA_MAX		0x7fff0000	/* Largest arena allocation, safe_malloc() takes an int */
+#define MAX_MISSING		1048576	/* Most of a truncated document that reads as zeros */
+#define READ_AHEAD		8		/* Files being read ahead of the one worked on */
+#define OUTPUT_BUFFER	65536	/* Output buffer of batch translations */
+#define DEBOUNCE		500		/* Quiet time, in ms, before changed documents are translated */
+#define STREAM_CHUNK	16384	/* Text read at a time when streaming, see streamPara() */
+#define PIPE_CHUNK		32768	/* Layout records sent at a time, see pipeLayout() */
+#define TRACE_SPANS		4096	/* Spans kept before they are written, see --trace */
+#define DIFF_CONTEXT	2		/* Paragraphs shown around a change, see --diff */
+#define HTTP_SLOTS		1024	/* Hash slots of the server cache, a power of 2 */
+#define HTTP_CACHE		16384	/* Default size of the server cache, in kbytes */
+#define HTTP_REQUEST	8192	/* Longest request header */
+#define HTTP_TIMEOUT	5		/* Seconds a client may take to send or receive */
+#define PACK_ALIGN		64		/* Documents in a container start at a multiple of this */
+#define MEMO_SLOTS		4096	/* Paragraphs kept by the paragraph cache, a power of 2 */
+#define NO_ENTRY		0xffffffff
+
+#define	L_END			0		/* Layout cache records, see recordLayout() */
+#define	L_PARA_START	1		/* Paragraph starts */
+#define	L_PARA_END		2		/* Paragraph ends */
+#define	L_RESET			3		/* Highlighting attributes closed and reset */
+#define	L_CLOSE			4		/* Highlighting attributes closed for a page break */
+#define	L_OPEN			5		/* ...and opened again after it */
+#define	L_MARGIN		6		/* Margin, signed word width follows */
+#define	L_LINE			7		/* Line of text, see recordLine() */
+#define	L_STRING		8		/* Blank, header or footer line, NULL terminated string follows */
+#define	L_PAGE			9		/* Page break, word page number follows */
+#define	L_HEADER		10		/* Next margin and string are the page header */
+#define	L_FOOTER		11		/* Next margin and string are the page footer */
+
 #define JUST_LEFT		0
 #define JUST_CENTRE		1
 #define JUST_RIGHT		2
 
+#ifdef _QDOS_
+#define DEFAULT_ENCODING	"ql"
+#else
+#define DEFAULT_ENCODING	"utf-8"
+#endif
+
+#ifdef __GNUC__
+#define SPECIALIZED		static inline __attribute__ ((always_inline))	/* made for each constant argument */
+#else
+#define SPECIALIZED		static
+#endif
+
+/* The converter state below is kept for each thread, so that threads of a */
+/* program using the converter (see QV_NO_MAIN) translate documents side by */
+/* side, each with its own. quill-view itself has one thread. */
+
+#if defined(_MSC_VER)
+#define PER_THREAD		__declspec(thread)
+#elif defined(__GNUC__)
+#define PER_THREAD		__thread
+#else
+#define PER_THREAD
+#endif
+
 #define isPrintable(c)	(c >= 0x20 && c < 0xC0)
 
 #ifndef MAX_PATH
@@ -130,7 +253,9 @@ typedef int bool;
 typedef unsigned char byte;
 typedef unsigned short ushort;
 
-typedef enum { Html, Text } Format;
+typedef enum { Html, Text, Json } Format;
+
+typedef enum { Utf8, Latin1, Cp1252, Utf16le, Ascii, Native } EncodingId;
 
 typedef struct {					/* File Header */
 	ushort		len;				/* Header length, should be 20 */
@@ -199,32 +324,375 @@ typedef struct {
 } TabEntry;
 const int TabEntrySize = sizeof(TabEntry);
 
-/*------------------------------------------------------------------------------- */
+/* Full-text index file. All numbers are stored big endian, like the Quill */
+/* document itself. The header is followed by the document table, the term */
+/* table sorted on term, the postings grouped by term and sorted on document, */
+/* paragraph and word, and finally the string pool holding names and terms. */
+
+typedef struct {					/* Index file header */
+	char		id[8];				/* Should be "qvindex1" */
+	unsigned	docCount;			/* Number of documents */
+	unsigned	termCount;			/* Number of terms */
+	unsigned	postCount;			/* Number of postings */
+	unsigned	stringLen;			/* Size of the string pool */
+} IndexHeader;
+const int IndexHeaderSize = sizeof(IndexHeader);
+
+typedef struct {
+	unsigned	name;				/* File name, offset in string pool */
+	unsigned	size;				/* File size when indexed */
+	unsigned	mtime;				/* File modification time when indexed */
+} IndexDoc;
+const int IndexDocSize = sizeof(IndexDoc);
+
+typedef struct {
+	unsigned	name;				/* Term (lower case UTF-8), offset in string pool */
+	unsigned	first;				/* First posting of this term */
+	unsigned	count;				/* Number of postings */
+} IndexTerm;
+const int IndexTermSize = sizeof(IndexTerm);
+
+typedef struct {
+	unsigned	doc;				/* Document number */
+	ushort		para;				/* Paragraph, the first after header and footer is 1 */
+	ushort		word;				/* Word number within the paragraph */
+} IndexPost;
+const int IndexPostSize = sizeof(IndexPost);
+
+/* Container of a corpus of documents, see --pack. The documents are stored */
+/* one after the other, each aligned to PACK_ALIGN, after a directory of them */
+/* sorted on name, with what --info lists already decoded. Numbers are big */
+/* endian, as in the index file. */
+
+typedef struct {					/* Container file header */
+	char		id[8];				/* Should be "qvpack01" */
+	unsigned	docCount;			/* Number of documents */
+	unsigned	stringLen;			/* Size of the string pool after the directory */
+} PackHeader;
+const int PackHeaderSize = sizeof(PackHeader);
+
+typedef struct {					/* Container directory entry */
+	unsigned	name;				/* File name without directory, offset in string pool */
+	unsigned	offset;				/* Where the document is in the container */
+	unsigned	size;				/* Size of the document */
+	unsigned	hash;				/* Hash of the document, see hashBytes() */
+	unsigned	textLen;			/* File header text length */
+	ushort		paraUsed;			/* Paragraph table entries used */
+	ushort		wordCount;			/* From the layout table */
+	ushort		tabSize;
+	byte		pageLen;
+	byte		headerF;
+	byte		footerF;
+	byte		valid;				/* Whether the document could be decoded */
+	ushort		spare;
+} PackDoc;
+const int PackDocSize = sizeof(PackDoc);
+
+/* Layout cache file, holding the layout of a document as a list of records, */
+/* followed by a table of where each paragraph starts. The records refer to */
+/* the text of the document, so they are only valid for the document and */
+/* layout format they were made by, but the paragraphs that are unchanged can be */
+/* used for a new version of the document. Numbers are big endian. */
+
+typedef struct {					/* Layout cache file header */
+	char		id[8];				/* Should be "qvlayout" */
+	char		version[40];		/* Format of the records, LAYOUT_VERSION */
+	unsigned	hash;				/* Hash of the document file */
+	unsigned	size;				/* Size of the document file */
+	unsigned	context;			/* Hash of what all paragraphs depend on, see layoutContext() */
+	unsigned	recordLen;			/* Bytes of records that follow */
+	unsigned	paraCount;			/* Paragraphs in the table after the records */
+} LayoutCacheHeader;
+const int LayoutCacheHeaderSize = sizeof(LayoutCacheHeader);
+
+typedef struct {					/* Layout cache paragraph */
+	unsigned	hash;				/* Hash of text and paragraph table entry, see hashPara() */
+	unsigned	offset;				/* Offset of the text */
+	unsigned	record;				/* Offset of its first record */
+	unsigned	lineNo;				/* Line and page number at start of paragraph */
+	unsigned	pageNo;
+} LayoutCachePara;
+const int LayoutCacheParaSize = sizeof(LayoutCachePara);
+
+typedef struct {					/* Layout read from a cache file */
+	LayoutCacheHeader	head;
+	byte				*rec;
+	LayoutCachePara		*para;
+} CachedLayout;
+
+typedef struct {					/* An output, laid out lines are rendered to each of them */
+	Format		format;
+	FILE		*fp;
+	bool		bold;				/* Html attributes currently on */
+	bool		sub;
+	bool		super;
+	bool		underline;
+	char		*newLine;
+	char		*space;
+	char		*paraStart;
+	char		*paraEnd;
+} Renderer;
+
+typedef struct {					/* Text output encoding, see setEncoding() */
+	char		*name;
+	EncodingId	id;
+	char		*bom;				/* byte order mark written first */
+	int			bomLen;
+	bool		wide;				/* ASCII takes two bytes */
+} Encoding;
+
+typedef struct {					/* A QL character in the output encoding */
+	byte		len;
+	char		seq[3];
+} Encoded;
+
+typedef struct {					/* QL characters outside of ASCII */
+	ushort		code;				/* Unicode */
+	byte		cp1252;				/* Windows-1252, if outside of Latin-1 */
+	char		*ascii;				/* nearest in ASCII */
+} Transliteration;
+
+typedef struct {					/* A laid out line, refers to the text rather than copy it */
+	char		*text;				/* Text buffer the line is in */
+	unsigned	start;				/* Offset of first character */
+	unsigned	end;				/* Offset after last character */
+	byte		*fill;				/* Width of each TAB on the line, NULL renders TAB as space */
+	unsigned	padFrom;			/* Justify: spaces after this offset are padded... */
+	int			spaces;				/* ...there are this many of them */
+	int			pads;				/* ...sharing this many extra spaces, see renderLine() */
+	int			margin;				/* Left margin, or padding of a centred line */
+	bool		pageBreak;			/* Form feed on the line, a new page follows it */
+} Line;
+
+typedef struct {					/* A line of a paragraph kept, see memoPara() */
+	unsigned	start;				/* Offsets from the start of the paragraph */
+	unsigned	end;
+	unsigned	padFrom;
+	int			spaces;
+	int			pads;
+	int			margin;
+	unsigned	fill;				/* Its tab widths, index in fills of ParaMemo */
+	bool		pageBreak;
+} MemoLine;
+
+typedef struct {					/* A paragraph laid out, kept for where it is used again */
+	unsigned	hash;				/* Of all below, see memoHash() */
+	unsigned	textLen;			/* Text, without the END_PARA */
+	unsigned	tabLen;				/* Tab entries of its tab table */
+	byte		leftMarg;
+	byte		indentMarg;
+	byte		rightMarg;
+	byte		justif;
+	unsigned	lineCount;
+	unsigned	size;				/* Of the block allocated */
+	MemoLine	*lines;				/* All of these are in the same block */
+	byte		*fills;
+	char		*text;
+	byte		*tabs;
+} ParaMemo;
+
+typedef struct ArenaBlock {			/* Per document memory, see arenaAlloc() */
+	struct ArenaBlock	*next;
+	unsigned			size;			/* Bytes available after this header */
+	unsigned			used;
+} ArenaBlock;
+
+typedef struct {					/* A page of the layout, see scanPages() */
+	unsigned	record;				/* Offset of its first record in layoutRec */
+	unsigned	end;				/* ...and after the last */
+	int			pageNo;
+	int			firstPara;			/* First paragraph on it, the first after header and footer is 1 */
+	byte		attrs;				/* Highlighting on at start, bit 0 is bold, see renderPage() */
+	bool		inPara;				/* Starts within a paragraph */
+} Page;
+
+typedef struct {					/* A timed part of the work, see traceSpan() */
+	char		*name;
+	char		*file;				/* Document worked on, or NULL */
+	unsigned	size;
+	double		start;				/* Microseconds */
+	double		end;
+} TraceSpan;
+
+typedef struct {					/* A document compared by --diff, see diffDocuments() */
+	char		*file;
+	char		*data;				/* The file as read, kept between load and render */
+	unsigned	size;
+	int			count;				/* Paragraphs after header and footer... */
+	unsigned	*hash;				/* ...the hash of each, see hashPara() */
+	int			*match;				/* ...the same paragraph in the other document, or -1 */
+	bool		*show;				/* ...laid out, as changed or near a change */
+	long		*start;				/* ...where it is in text */
+	char		*text;				/* Paragraphs shown, laid out */
+} DiffDoc;
+
+typedef struct {					/* A paragraph hash, see diffAlign() */
+	unsigned	hash;
+	int			countA;				/* Times in each document... */
+	int			countB;
+	int			posA;				/* ...and where, the last time */
+	int			posB;
+} DiffSym;
+
+typedef struct {					/* An edit, see diffDocuments() */
+	char		op;					/* '-' deleted, '+' inserted or ' ' same */
+	int			i;					/* Paragraph in each document */
+	int			j;
+	bool		show;
+} DiffOp;
+
+typedef struct HttpEntry {			/* A translation kept by the server, see httpRequest() */
+	struct HttpEntry	*prev;			/* Least recently used list, newest first */
+	struct HttpEntry	*next;
+	struct HttpEntry	*chain;			/* Next in the same hash slot */
+	char				*path;
+	Format				format;
+	unsigned			size;			/* Of the document file... */
+	unsigned			mtime;			/* ...and when it was written */
+	char				etag[32];
+	char				*body;
+	unsigned			bodyLen;
+	char				*gzip;			/* Body compressed, or NULL */
+	unsigned			gzipLen;
+} HttpEntry;
+
+typedef struct {					/* Posting while building the index */
+	unsigned	term;
+	IndexPost	post;
+} IndexOcc;
 
-Format			format;
-unsigned		offset;				/* offset in file (number of bytes read so far) */
-Header			header;
-char			*textBuffer;
-ParaTableHead	parTableHead;
-ParaTable		*parTable;
-LayoutTable		layoutTable;
-TabHeader		*tabTable;
-char			headerPara[128];
-char			footerPara[128];
-int				lineNo;
-int				pageNo;
-int				minLmarg;
-int				maxRmarg;
-int				maxLines;
-int				paraCount;
-bool			bold = false;
-bool			sub = false;
-bool			super = false;
-bool			underline = false;
-char			*renderNewLine;
-char			*renderSpace;
-char			*renderParaStart;
-char			*renderParaEnd;
+/*------------------------------------------------------------------------------- */
+/* Converter state, see PER_THREAD */
+
+PER_THREAD Format				format;
+PER_THREAD unsigned				offset;				/* offset in file (number of bytes read so far) */
+PER_THREAD Header				header;
+PER_THREAD char					*textBuffer;
+PER_THREAD ParaTableHead		parTableHead;
+PER_THREAD ParaTable			*parTable;
+PER_THREAD LayoutTable			layoutTable;
+PER_THREAD TabHeader			*tabTable;
+PER_THREAD char					*headerPara;		/* header and footer text, in textBuffer */
+PER_THREAD char					*footerPara;
+PER_THREAD char					*hfLine;			/* header or footer with page number filled in */
+PER_THREAD byte					*lineFill;			/* width of each tab on the line being laid out */
+PER_THREAD int					lineNo;
+PER_THREAD int					pageNo;
+PER_THREAD int					minLmarg;
+PER_THREAD int					maxRmarg;
+PER_THREAD int					maxLines;
+PER_THREAD int					paraCount;
+PER_THREAD unsigned				*paraIndex;			/* paragraph table entry for an offset, see getPara() */
+PER_THREAD unsigned				paraIndexSize;
+PER_THREAD char					*docData;			/* the document file as read, or NULL when streamed */
+PER_THREAD unsigned				docSize;
+PER_THREAD FILE					*streamFile;		/* document being streamed, see openDocument() */
+PER_THREAD bool					streaming;			/* --stream */
+PER_THREAD char					*window;			/* text of current paragraph and on, when streaming */
+PER_THREAD byte					*windowFill;		/* lineFill while streaming, as big as the window */
+PER_THREAD unsigned				windowAlloc;
+PER_THREAD unsigned				windowLen;
+PER_THREAD unsigned				textBase;			/* text offset of textBuffer[0] */
+PER_THREAD Renderer				renderers[MAX_RENDERERS];
+PER_THREAD int					rendererCount;
+PER_THREAD Renderer				*rd;				/* renderer being written to */
+PER_THREAD Encoding				*encoding;			/* of text output, see --encoding */
+PER_THREAD Encoded				encodeTable[0x100];	/* each QL character in it */
+PER_THREAD char					*docName;			/* source file of the document translated */
+PER_THREAD ParaTable			*paraTab;			/* paragraph being laid out, see drawParaRecord() */
+PER_THREAD unsigned				paraText;			/* ...its text offset */
+PER_THREAD int					paraPage;			/* ...and the page of its first line */
+
+PER_THREAD char					*idxPool;			/* names and terms of the index being built */
+PER_THREAD unsigned				idxPoolLen;
+PER_THREAD unsigned				idxPoolAlloc;
+PER_THREAD IndexDoc				*idxDocs;
+PER_THREAD unsigned				idxDocCount;
+PER_THREAD unsigned				idxDocAlloc;
+PER_THREAD unsigned				*idxTermName;		/* pool offset of each term */
+PER_THREAD unsigned				idxTermCount;
+PER_THREAD unsigned				idxTermAlloc;
+PER_THREAD unsigned				*idxHash;			/* term number + 1 for each used slot */
+PER_THREAD unsigned				idxHashSize;
+PER_THREAD IndexOcc				*idxOccs;
+PER_THREAD unsigned				idxOccCount;
+PER_THREAD unsigned				idxOccAlloc;
+PER_THREAD int					jobs;				/* number of worker processes, 0 = one per CPU */
+PER_THREAD ArenaBlock			*arena;				/* per document memory, newest block first */
+PER_THREAD unsigned				arenaLimit = ARENA_LIMIT * 1024;
+PER_THREAD jmp_buf				*recovery;			/* where error() goes back to rather than exit, or NULL */
+PER_THREAD FILE					*workIn;			/* files open for the document of a batch, closed */
+PER_THREAD FILE					*workOut;			/* when it is abandoned, see workOne() */
+PER_THREAD char					workTarget[MAX_PATH * 2 + 8];
+PER_THREAD char					grepPattern[MAX_PATTERN + 1];
+PER_THREAD int					grepLen;
+PER_THREAD char					*cacheDir;			/* directory of layout cache files, see --cache */
+PER_THREAD char					*batchDir;			/* directory of translated files, see --batch */
+PER_THREAD ParaMemo				*memoSlot[MEMO_SLOTS];	/* paragraphs laid out, see --para-cache */
+PER_THREAD unsigned				memoDoor[MEMO_SLOTS];	/* ...hash of the last one not kept in each slot */
+PER_THREAD unsigned				memoLen;
+PER_THREAD unsigned				memoLimit;			/* 0 when there is no paragraph cache */
+PER_THREAD unsigned				memoHits;
+PER_THREAD unsigned				memoLookups;
+PER_THREAD bool					memoing;			/* the paragraph laid out is kept, see memoLine() */
+PER_THREAD unsigned				budgetLines;		/* most lines of a document, 0 for no limit, see spend() */
+PER_THREAD unsigned				budgetOutput;		/* ...characters laid out */
+PER_THREAD double				budgetTime;			/* ...seconds of CPU time */
+PER_THREAD unsigned				docLines;			/* spent on the document so far */
+PER_THREAD unsigned				docOutput;
+PER_THREAD clock_t				docStart;
+PER_THREAD char					*overBudget;		/* what the document ran out of, or NULL */
+PER_THREAD MemoLine				*memoLines;			/* ...its lines so far */
+PER_THREAD unsigned				memoLineCount;
+PER_THREAD unsigned				memoLineAlloc;
+PER_THREAD byte					*memoFills;
+PER_THREAD unsigned				memoFillLen;
+PER_THREAD unsigned				memoFillAlloc;
+PER_THREAD char					*packName;			/* container of documents, see --packed */
+PER_THREAD char					*packData;			/* ...all of it, mapped into memory */
+PER_THREAD unsigned				packSize;
+PER_THREAD PackDoc				*packDocs;			/* ...its directory, in host byte order */
+PER_THREAD unsigned				packCount;
+PER_THREAD char					*packStrings;
+PER_THREAD unsigned				docHash;			/* hash of the document, see documentHash() */
+PER_THREAD bool					docHashed;
+PER_THREAD char					**pending;			/* documents changed, see watchDirectory() */
+PER_THREAD int					pendingCount;
+PER_THREAD int					pendingAlloc;
+PER_THREAD unsigned				*pendingHash;		/* pending index + 1 for each used slot */
+PER_THREAD unsigned				pendingHashSize;
+PER_THREAD bool					recording;			/* layout is recorded to layoutRec */
+PER_THREAD bool					pipelining;			/* --pipeline */
+PER_THREAD FILE					*pipeOut;			/* layout records are sent to the renderer, see pipeLayout() */
+PER_THREAD byte					*layoutRec;
+PER_THREAD unsigned				layoutRecLen;
+PER_THREAD unsigned				layoutRecAlloc;
+PER_THREAD LayoutCachePara		*layoutPara;		/* where each paragraph starts in layoutRec */
+PER_THREAD ParaTable			**layoutParaTab;	/* ...and the paragraph table entry used for it */
+PER_THREAD unsigned				layoutParaCount;
+PER_THREAD unsigned				layoutParaAlloc;
+PER_THREAD char					*pageDir;			/* directory of page files, see --pages */
+PER_THREAD Page					*pages;
+PER_THREAD char					**pageNames;
+PER_THREAD int					pageCount;
+PER_THREAD int					pageAlloc;
+PER_THREAD FILE					*traceFp;			/* trace of the work, see --trace */
+PER_THREAD char					*traceName;
+PER_THREAD TraceSpan			*traceSpans;
+PER_THREAD int					traceCount;
+PER_THREAD int					traceId;			/* process id in the trace... */
+PER_THREAD int					worker;				/* ...and thread, the worker number, 0 for the main process */
+PER_THREAD char					*traceDoc;			/* document worked on, for the trace */
+PER_THREAD unsigned				traceSize;
+PER_THREAD bool					unpaged;			/* page breaks are left out, see diffRender() and excerpt() */
+PER_THREAD int					paraFrom;			/* paragraphs laid out, see --paras */
+PER_THREAD int					paraTo;
+PER_THREAD char					*httpDir;			/* directory served, see serveHttp() */
+PER_THREAD HttpEntry			*httpSlot[HTTP_SLOTS];
+PER_THREAD HttpEntry			*httpNewest;
+PER_THREAD HttpEntry			*httpOldest;
+PER_THREAD unsigned				httpCacheLen;
+PER_THREAD unsigned				httpCacheLimit = HTTP_CACHE * 1024;
 
 /* NOTE: THIS WILL ONLY WORK WITH DEFAULT CHAR UNSIGNED. */
 
@@ -248,6 +716,58 @@ unsigned int xlate_utf_8[0x100] = {
 	' ',   ' ',   ' ',	 ' ',	' ',   ' ',   ' ',	 ' ',		' ',   ' ',   ' ',	 ' ',	' ',   ' ',   ' ',	 ' '				/* f0 */
 };
 
+/* Case folding for word search. Maps a QL character to its lower case */
+/* equivalent, 0 if it separates words and 1 if it is ignored within a word. */
+
+byte xlate_fold[0x100] = {
+/*	0		 1		2	   3	  4		 5		6	   7		  8		 9		a	   b	  c		 d		e	   f	 */
+	0,     0,     0,     0,     0,     0,     0,     0,      0,     0,     0,     0,     0,     0,     0,     1,		/* 00 */
+	1,     1,     1,     0,     0,     0,     0,     0,      0,     0,     0,     0,     0,     0,     1,     0,		/* 10 */
+	0,     0,     0,     0,     0,     0,     0,     0,      0,     0,     0,     0,     0,     0,     0,     0,		/* 20 */
+	'0',   '1',   '2',   '3',   '4',   '5',   '6',   '7',    '8',   '9',   0,     0,     0,     0,     0,     0,		/* 30 */
+	0,     'a',   'b',   'c',   'd',   'e',   'f',   'g',    'h',   'i',   'j',   'k',   'l',   'm',   'n',   'o',		/* 40 */
+	'p',   'q',   'r',   's',   't',   'u',   'v',   'w',    'x',   'y',   'z',   0,     0,     0,     0,     0,		/* 50 */
+	0,     'a',   'b',   'c',   'd',   'e',   'f',   'g',    'h',   'i',   'j',   'k',   'l',   'm',   'n',   'o',		/* 60 */
+	'p',   'q',   'r',   's',   't',   'u',   'v',   'w',    'x',   'y',   'z',   0,     0,     0,     0,     0,		/* 70 */
+	0x80,  0x81,  0x82,  0x83,  0x84,  0x85,  0x86,  0x87,   0x88,  0x89,  0x8A,  0x8B,  0x8C,  0x8D,  0x8E,  0x8F,		/* 80 */
+	0x90,  0x91,  0x92,  0x93,  0x94,  0x95,  0x96,  0x97,   0x98,  0x99,  0x9A,  0x9B,  0x9C,  0,     0,     0,		/* 90 */
+	0x80,  0x81,  0x82,  0x83,  0x84,  0x85,  0x86,  0x87,   0x88,  0x89,  0x8A,  0x8B,  0xAC,  0xAD,  0xAE,  0xAF,		/* a0 */
+	0xB0,  0xB1,  0xB2,  0,     0,     0,     0,     0,      0,     0,     0,     0,     0,     0,     0,     0,		/* b0 */
+	0,     0,     0,     0,     0,     0,     0,     0,      0,     0,     0,     0,     0,     0,     0,     0,		/* c0 */
+	0,     0,     0,     0,     0,     0,     0,     0,      0,     0,     0,     0,     0,     0,     0,     0,		/* d0 */
+	0,     0,     0,     0,     0,     0,     0,     0,      0,     0,     0,     0,     0,     0,     0,     0,		/* e0 */
+	0,     0,     0,     0,     0,     0,     0,     0,      0,     0,     0,     0,     0,     0,     0,     0		/* f0 */
+};
+
+Encoding encodings[] = {
+	{ "utf-8",		Utf8,		"\xEF\xBB\xBF",	3, false },
+	{ "latin-1",	Latin1,		"",				0, false },
+	{ "cp1252",		Cp1252,		"",				0, false },
+	{ "utf-16le",	Utf16le,	"\xFF\xFE",		2, true },
+	{ "ascii",		Ascii,		"",				0, false },
+	{ "ql",			Native,		"",				0, false }		/* as in the document */
+};
+
+Transliteration xlate_other[] = {
+	{ 0x00A1, 0, "!" },		{ 0x00A2, 0, "c" },		{ 0x00A3, 0, "GBP" },	{ 0x00A4, 0, "*" },
+	{ 0x00A5, 0, "Y" },		{ 0x00A7, 0, "S" },		{ 0x00A9, 0, "(c)" },	{ 0x00AB, 0, "<<" },
+	{ 0x00B5, 0, "u" },		{ 0x00BA, 0, "o" },		{ 0x00BB, 0, ">>" },	{ 0x00BF, 0, "?" },
+	{ 0x00C3, 0, "A" },		{ 0x00C4, 0, "A" },		{ 0x00C5, 0, "A" },		{ 0x00C6, 0, "AE" },
+	{ 0x00C7, 0, "C" },		{ 0x00C9, 0, "E" },		{ 0x00D1, 0, "N" },		{ 0x00D5, 0, "O" },
+	{ 0x00D6, 0, "O" },		{ 0x00D8, 0, "O" },		{ 0x00DC, 0, "U" },		{ 0x00DF, 0, "ss" },
+	{ 0x00E0, 0, "a" },		{ 0x00E1, 0, "a" },		{ 0x00E2, 0, "a" },		{ 0x00E3, 0, "a" },
+	{ 0x00E4, 0, "a" },		{ 0x00E5, 0, "a" },		{ 0x00E7, 0, "c" },		{ 0x00E8, 0, "e" },
+	{ 0x00E9, 0, "e" },		{ 0x00EA, 0, "e" },		{ 0x00EB, 0, "e" },		{ 0x00EC, 0, "i" },
+	{ 0x00ED, 0, "i" },		{ 0x00EE, 0, "i" },		{ 0x00EF, 0, "i" },		{ 0x00F1, 0, "n" },
+	{ 0x00F2, 0, "o" },		{ 0x00F3, 0, "o" },		{ 0x00F4, 0, "o" },		{ 0x00F5, 0, "o" },
+	{ 0x00F6, 0, "o" },		{ 0x00F7, 0, "/" },		{ 0x00F8, 0, "o" },		{ 0x00F9, 0, "u" },
+	{ 0x00FA, 0, "u" },		{ 0x00FB, 0, "u" },		{ 0x00FC, 0, "u" },		{ 0x0152, 0x8C, "OE" },
+	{ 0x0153, 0x9C, "oe" },	{ 0x01FD, 0, "ae" },	{ 0x03A0, 0, "P" },		{ 0x03A6, 0, "Ph" },
+	{ 0x03B1, 0, "a" },		{ 0x03B4, 0, "d" },		{ 0x03B8, 0, "th" },	{ 0x03BB, 0, "l" },
+	{ 0x20AC, 0x80, "EUR" },	{ 0x2190, 0, "<-" },	{ 0x2191, 0, "^" },		{ 0x2192, 0, "->" },
+	{ 0x2193, 0, "v" }
+};
+
 /*------------------------------------------------------------------------------- */
 #ifndef _QDOS_
 ushort BEword(ushort be)
@@ -275,29 +795,58 @@ unsigned BElong(unsigned be)
 #endif	/* not _QDOS_ */
 
 /*------------------------------------------------------------------------------- */
-void io_error(char *format, char *arg)
+/* Report an error and exit, or, while a document is worked on by a process */
+/* that goes on with others, give up on just that document, see recovery */
+void error(char *msg)
 {
-	char msg[512];
-
-	sprintf(msg, format, arg, strerror(errno));
-
 #ifdef _WIN32
 	MessageBox(NULL, msg, ME, MB_OK | MB_ICONERROR);
 #else
-	fprintf(stderr, msg);
+	fprintf(stderr, "%s", msg);
 #endif
+	if(recovery != NULL)
+		longjmp(*recovery, 1);
 	exit(1);
 }
 
 /*------------------------------------------------------------------------------- */
-void error(char *msg)
+void io_error(char *format, char *arg)
 {
-#ifdef _WIN32
-	MessageBox(NULL, msg, ME, MB_OK | MB_ICONERROR);
-#else
-	fprintf(stderr, msg);
-#endif
-	exit(1);
+	char msg[512];
+
+	sprintf(msg, format, arg, strerror(errno));
+	error(msg);
+}
+
+/*------------------------------------------------------------------------------- */
+void *safe_malloc(int size)
+{
+	void *p;
+	char msg[64];
+
+	p = malloc(size);
+
+	if(p == NULL)
+	{
+		sprintf(msg, "quill-view: cant allocate %d bytes of memory\n", size);
+		error(msg);
+	}
+	return p;
+}
+
+/*------------------------------------------------------------------------------- */
+void *safe_realloc(void *p, int size)
+{
+	char msg[64];
+
+	p = realloc(p, size);
+
+	if(p == NULL)
+	{
+		sprintf(msg, "quill-view: cant allocate %d bytes of memory\n", size);
+		error(msg);
+	}
+	return p;
 }
 
 /*------------------------------------------------------------------------------- */
@@ -306,13 +855,64 @@ void usage()
 #if defined(_WIN32)
 	MessageBox(NULL, "usage:\n\nquill-view filename\nor\nquill-view [-t|-m] source-file target-file\n\nTip 1: Drag and drop a file to the program icon.\nTip 2: Hold down Alt-Key while dropping to show file in notepead.\n\n", ME, MB_OK | MB_ICONINFORMATION);
 #elif defined(_QDOS_)
-	fprintf(stderr, "quill-view [-t|-m] [source-file [target-file]]\n");
+	fprintf(stderr, "quill-view [-t|-m|-j] [source-file [target-file]]\n");
 	fprintf(stderr, "			-t translates to text (QDOS ASCII) format (default)\n");
 	fprintf(stderr, "			-m translates to HTML format\n");
+	fprintf(stderr, "			-j translates to JSON Lines, a record per paragraph\n");
 #else
-	fprintf(stderr, "quill-view [-t|-m] [source-file [target-file]]\n");
+	fprintf(stderr, "quill-view [-t|-m|-j] [source-file [target-file]]\n");
 	fprintf(stderr, "			-t translates to UTF-8 text format (default)\n");
 	fprintf(stderr, "			-m translates to HTML format\n");
+	fprintf(stderr, "			-j translates to JSON Lines, a record per paragraph\n");
+	fprintf(stderr, "quill-view -t|-m|-j target-file [-t|-m|-j target-file...] [source-file]\n");
+	fprintf(stderr, "			translates to several formats in one pass\n");
+	fprintf(stderr, "quill-view [-t|-m|-j] [--jobs n] --batch target-directory|- source-file...\n");
+	fprintf(stderr, "			translates each file to a file of the same name in the directory,\n");
+	fprintf(stderr, "			or all of them to stdout, e.g. as one JSON Lines stream\n");
+	fprintf(stderr, "quill-view --pack container source-file|directory...\n");
+	fprintf(stderr, "			packs documents into one file, for batches of them to be read fast\n");
+	fprintf(stderr, "quill-view [-t|-m|-j] [--jobs n] --packed container --batch target-directory|- [name...]\n");
+	fprintf(stderr, "			translates the documents named, or all, in the container\n");
+	fprintf(stderr, "			or, with --info, lists them from its directory\n");
+	fprintf(stderr, "quill-view [-t|-m|-j] --paras n[-m] [source-file [target-file]]\n");
+	fprintf(stderr, "			translates paragraphs n to m, from 1 after header and footer,\n");
+	fprintf(stderr, "			without page breaks; n- is to the end\n");
+	fprintf(stderr, "quill-view [-t|-m] [--jobs n] --pages target-directory [source-file]\n");
+	fprintf(stderr, "			translates each page to a file of its own, listed in an index file\n");
+#ifdef __linux__
+	fprintf(stderr, "quill-view [-t|-m|-j] [--jobs n] --watch source-directory target-directory\n");
+	fprintf(stderr, "			translates documents in the directory whenever they change\n");
+#endif
+	fprintf(stderr, "quill-view --index index-file source-file...\n");
+	fprintf(stderr, "			adds or updates documents in a full-text index\n");
+	fprintf(stderr, "quill-view --query index-file word...\n");
+	fprintf(stderr, "			lists paragraphs containing the word, or phrase\n");
+	fprintf(stderr, "quill-view [--jobs n] --grep pattern source-file...\n");
+	fprintf(stderr, "			lists paragraphs containing the pattern\n");
+	fprintf(stderr, "quill-view [--encoding name] --diff old-file new-file\n");
+	fprintf(stderr, "			lists the paragraphs changed, as a unified diff of their text\n");
+	fprintf(stderr, "quill-view [-j] [--jobs n] --info source-file|directory...\n");
+	fprintf(stderr, "			lists the size, page length, word count etc. of documents, as\n");
+	fprintf(stderr, "			CSV or JSON Lines, without reading their text\n");
+	fprintf(stderr, "quill-view [-t|-m|-j] --http port source-directory\n");
+	fprintf(stderr, "			serves the documents in the directory on localhost, as\n");
+	fprintf(stderr, "			http://127.0.0.1:port/name?format=text|html|json\n");
+	fprintf(stderr, "--http-cache kbytes	translations kept by the server (default %d)\n", HTTP_CACHE);
+	fprintf(stderr, "--para-cache kbytes	lays out paragraphs that are in many documents only once,\n");
+	fprintf(stderr, "			and reports how many were reused\n");
+	fprintf(stderr, "--max-lines n, --max-output kbytes, --max-time seconds\n");
+	fprintf(stderr, "			of a document, laid out or of CPU time; one over it is cut short,\n");
+	fprintf(stderr, "			with an error, and a batch goes on with the next\n");
+	fprintf(stderr, "--cache directory	keeps the layout of documents translated, to render them again\n");
+	fprintf(stderr, "			without decoding, or only the changes when edited\n");
+	fprintf(stderr, "--encoding name	of text output: utf-8 (default), latin-1, cp1252, utf-16le, ascii,\n");
+	fprintf(stderr, "			or ql for the characters as in the document\n");
+	fprintf(stderr, "--trace file		writes when each document is loaded, decoded, laid out and\n");
+	fprintf(stderr, "			written, by each worker, in Chrome trace event format\n");
+	fprintf(stderr, "--pipeline		renders a document in another process as it is laid out\n");
+	fprintf(stderr, "--stream		reads the text a paragraph at a time, memory doesn't grow with\n");
+	fprintf(stderr, "			the document\n");
+	fprintf(stderr, "--arena-limit kbytes	memory kept between documents (default %d)\n", ARENA_LIMIT);
 #endif
 	exit(1);
 }
@@ -320,26 +920,57 @@ void usage()
 /*------------------------------------------------------------------------------- */
 int getByte()
 {
-	if(offset >= (header.textLen - HeaderSize))
+	if(textBase + offset >= (header.textLen - HeaderSize))
 		return EOF;
 	else
 		return textBuffer[offset++];
 }
 
 /*------------------------------------------------------------------------------- */
+#define paraSlot(offset)	(((offset) * 2654435761u) & (paraIndexSize - 1))
+
 ParaTable *getPara(unsigned offset)
 {
-	int i;
+	unsigned h;
 
-	for(i = 1; i < parTableHead.used; ++i)		/* skip first entry (set i = 1), always garbage? */
+	for(h = paraSlot(offset + 20); paraIndex[h] != 0; h = (h + 1) & (paraIndexSize - 1))
+	{
+		if(parTable[paraIndex[h]].offset == offset + 20)	/* add 20, we don't have a header here */
+			return &parTable[paraIndex[h]];
+	}
+
+	return NULL;	/* not there! */
+}
+
+/*------------------------------------------------------------------------------- */
+/* The tab area ends at tabSize, or at a length that doesn't move on, as a */
+/* damaged document may have */
+TabHeader *findTabTable(int table)
+{
+	TabHeader	*pt;
+	unsigned	pos;
+
+	for(pos = 0; pos < layoutTable.tabSize; pos += pt->length & ~1)
 	{
-		if(parTable[i].offset == offset + 20)	/* add 20, we don't have a header here */
-			return &parTable[i];
+		pt = (TabHeader *) ((byte *) tabTable + pos);
+
+		if(pt->entry == 0 || pt->length < TabHeaderSize)
+			break;
+		if(pt->entry == table)
+			return pt;
 	}
 
 	return NULL;	/* not there! */
 }
 
+/*------------------------------------------------------------------------------- */
+int tabCount(TabHeader *pt)			/* entries of a tab table, those within the tab area */
+{
+	unsigned pos = (unsigned) ((byte *) pt - (byte *) tabTable);
+
+	return (int) (min(pt->length, layoutTable.tabSize - pos) / 2) - 1;
+}
+
 /*------------------------------------------------------------------------------- */
 int getNextTab(int table, int column)
 {
@@ -347,15 +978,11 @@ int getNextTab(int table, int column)
 	TabEntry *pe;
 	int i;
 
-	/* find the table */
-	for(pt = tabTable; (pt->entry != 0) && (pt->entry != table); pt += pt->length / 2)
-		;
-
-	/* found, search for next tab given current column */
-	if(pt->entry == table)
+	/* find the table, and search for next tab given current column */
+	if((pt = findTabTable(table)) != NULL)
 	{
 		pe = (TabEntry*) pt + 1;
-		for(i = 0; i < (pt->length / 2) - 1; ++i)
+		for(i = 0; i < tabCount(pt); ++i)
 			if(pe[i].pos >= column)
 				return pe[i].pos;
 	}
@@ -364,855 +991,5263 @@ int getNextTab(int table, int column)
 }
 
 /*------------------------------------------------------------------------------- */
-void renderLine(char *line) // SNG, suppress sprintf warning (was byte *)
+int xlateChar(int c, char *seq)
 {
-	unsigned c;
+	unsigned u = xlate_utf_8[c];
+	int len = 0;
 
-	++lineNo;
+	seq[len++] = u & 0x0000ff;
+	if(u > 0xff)
+	{
+		seq[len++] = (u & 0x00ff00) >> 8;
+		if((u & 0x0000ff) == 0xE2)
+			seq[len++] = (u & 0xff0000) >> 16;
+	}
+
+	return len;
+}
+
+/*------------------------------------------------------------------------------- */
+unsigned qlUnicode(int c)				/* code point of a QL character, from xlate_utf_8 */
+{
+	unsigned u = xlate_utf_8[c];
+
+	if(u <= 0xff)
+		return u;
+	else if((u & 0x0000ff) == 0xE2)
+		return ((u & 0x0f) << 12) | ((u & 0x3f00) >> 2) | ((u & 0x3f0000) >> 16);
+	else
+		return ((u & 0x1f) << 6) | ((u & 0x3f00) >> 8);
+}
+
+/*------------------------------------------------------------------------------- */
+void encodeChar(Encoded *e, int c)
+{
+	unsigned	code = qlUnicode(c);
+	char		*ascii = "?";
+	int			i;
 
-	if(format == Text)
+	e->len = 0;
+
+	switch(c)
+	{
+	case BOLD:						/* not shown in text */
+	case UNDELINE:
+	case SUB_SCRIPT:
+	case SUPER_SCRIPT:
+	case FORM_FEED:
+		return;
+	}
+
+	switch(encoding->id)
 	{
-		while(*line)
+	case Utf8:
+		e->len = xlateChar(c, e->seq);
+		return;
+	case Native:
+		e->seq[e->len++] = c == TAB ? ' ' : c;
+		return;
+	case Utf16le:
+		e->seq[e->len++] = code & 0xff;
+		e->seq[e->len++] = code >> 8;
+		return;
+	case Latin1:
+	case Cp1252:
+		if(code < 0x80 || (code >= 0xA0 && code <= 0xff))
 		{
-			switch(*line)
-			{
-			case BOLD:
-			case UNDELINE:
-			case SUB_SCRIPT:
-			case SUPER_SCRIPT:
-			case FORM_FEED:
-				break;
-			default:
-#ifdef _QDOS_
-				c = *line;
-				if(c == TAB)
-					c = ' ';
-				putchar(c);
-#else
-				c = xlate_utf_8[*line];
-				if(c > 0xff)
-				{
-					putchar(c & 0x0000ff);
-					if((c & 0x0000ff) == 0xE2)
-					{
-						putchar((c & 0x00ff00) >> 8);
-						putchar((c & 0xff0000) >> 16);
-					}
-					else
-					{
-						putchar((c & 0x00ff00) >> 8);
-					}
-				}
-				else
-				{
-					putchar(c);
-				}
-#endif
-				break;
-			}
-			++line;
+			e->seq[e->len++] = code;
+			return;
 		}
+		break;
+	case Ascii:
+		if(code < 0x80)
+		{
+			e->seq[e->len++] = code;
+			return;
+		}
+		break;
 	}
-	else
+
+	for(i = 0; i < (int) (sizeof(xlate_other) / sizeof(xlate_other[0])); ++i)
 	{
-		while(*line)
+		if(xlate_other[i].code == code)
 		{
-			switch(*line)
+			if(encoding->id == Cp1252 && xlate_other[i].cp1252 != 0)
 			{
-			case BOLD:
-				printf(bold ? "</b>" : "<b>");
-				bold = ! bold;
-				break;
-			case UNDELINE:
-				printf(underline ? "</u>" : "<u>");
-				underline = ! underline;
-				break;
-			case SUB_SCRIPT:
-				printf(sub ? "</sub>" : "<sub>");
-				sub = ! sub;
-				break;
-			case SUPER_SCRIPT:
-				printf(super ? "</sup>" : "<sup>");
-				super = ! super;
-				break;
-			case FORM_FEED:
-				break;
-			case SOFT_HYPEN:
-				putchar('-');
-				break;
-			case '<':
-				printf("&lt;");
-				break;
-			case '>':
-				printf("&gt;");
-				break;
-			case SPACE:
-			case TAB:
-				printf("&nbsp;"); /* &nbsp	*/
-				break;
-			default:
-				c = xlate_utf_8[*line];
-				if(c > 0x100)
-				{
-					putchar(c & 0x0000ff);
-					if((c & 0x0000ff) == 0xE2)
-					{
-						putchar((c & 0x00ff00) >> 8);
-						putchar((c & 0xff0000) >> 16);
-					}
-					else
-					{
-						putchar((c & 0x00ff00) >> 8);
-					}
-				}
-				else
-					putchar(c);
-				break;
-
+				e->seq[e->len++] = xlate_other[i].cp1252;
+				return;
 			}
-			++line;
+			ascii = xlate_other[i].ascii;
 		}
 	}
-	printf(renderNewLine);
+
+	for(; *ascii; ++ascii)
+		e->seq[e->len++] = *ascii;
 }
 
 /*------------------------------------------------------------------------------- */
-void renderMargin(int leftPad)
+/* Select the encoding of text output, and work out what each QL character is */
+/* in it, so that renderChar() only has to look it up */
+bool setEncoding(char *name)
 {
-	if(format == Text)
+	Encoding	*e;
+	int			c;
+
+	for(e = encodings; e < &encodings[sizeof(encodings) / sizeof(encodings[0])]; ++e)
 	{
-		while(leftPad-- > 0)
-			printf(renderSpace);
+		if(strcmp(e->name, name) == 0)
+		{
+			encoding = e;
+			for(c = 0; c < 0x100; ++c)
+				encodeChar(&encodeTable[c], c);
+			return true;
+		}
 	}
-	else
-	{
-		if(bold)	printf("</b>");
-		if(underline)	printf("</u>");
-		if(sub)		printf("</sub>");
-		if(super)	printf("</sup>");
-
-		while(leftPad-- > 0)
-			printf(renderSpace);
 
-		if(bold)	printf("<b>");
-		if(underline)	printf("<u>");
-		if(sub)		printf("<sub>");
-		if(super)	printf("<sup>");
-	}
+	return false;			/* unknown, the encoding is as it was */
 }
 
 /*------------------------------------------------------------------------------- */
-void renderHeaderFooter(char *str, bool head)
+int utf8ToQL(char *str, char *ql)		/* reverse of xlate_utf_8, for command line arguments */
 {
-	char line[128];     // SNG, suppress sprintf warning (was byte *)
-	char *pLine = line; // SNG, was byte *
-	bool useBold = false;
-	int width, length;
-
-	if((head && layoutTable.headerF == 0) || (!head && layoutTable.footerF == 0))
-		return;
-
-	*pLine = 0;
-
-	width = maxRmarg - minLmarg;
-
-	if((head && layoutTable.headerBold) || (! head && layoutTable.footerBold))
-	{
-		*pLine++ = BOLD;
-		useBold = true;
-	}
+	char seq[4];
+	int c, len, n = 0;
 
 	while(*str)
 	{
-		if(str[0] == 'n' && str[1] == 'n' && str[2] == 'n')			/* digit page number? */
+		for(c = SPACE; c < 0xC0; ++c)
 		{
-			sprintf(pLine, "%d", pageNo);
-			while(*pLine)
-				++pLine;
-
-			str = &str[3];																					/* advance source pointer after 'nnn' */
+			len = xlateChar(c, seq);
+			if(strncmp(str, seq, len) == 0)
+				break;
 		}
-		else if(str[0] == 'a' && str[1] == 'a' && str[2] == 'a')	/* alpha page number? */
-		{
-			sprintf(pLine, "%d", pageNo);
-			while(*pLine)
-				++pLine;
 
-			str = &str[3];																					/* advance source pointer after 'nnn' */
-		}
-		else if(str[0] == 'r' && str[1] == 'r' && str[2] == 'r')	/* roman page number? */
+		if(c < 0xC0)
 		{
-			sprintf(pLine, "%d", pageNo);
-			while(*pLine)
-				++pLine;
-
-			str = &str[3];																					/* advance source pointer after 'nnn' */
+			ql[n++] = c;
+			str += len;
 		}
 		else
-			*pLine++ = *str++;
+		{
+			ql[n++] = '?';						/* no QL equivalent, skip whole UTF-8 sequence */
+			while((*++str & 0xC0) == 0x80)
+				;
+		}
 	}
 
-	if(useBold)
-		*pLine++ = BOLD;
-
-	*pLine = 0;
+	ql[n] = 0;
+	return n;
+}
 
-	length = (int) strlen(line);
+/*------------------------------------------------------------------------------- */
+/* Collect the next word of the paragraph starting at text[*pos], folded to */
+/* lower case and translated to UTF-8. Returns 0 at the end of the paragraph. */
+int getWord(char *text, unsigned *pos, unsigned end, char *word)
+{
+	unsigned i = *pos;
+	int len = 0, chars = 0;
+	int c;
 
-	if(useBold)
-		length -= 2;
+	while(i < end && text[i] != END_PARA && xlate_fold[(byte) text[i]] <= 1)		/* skip to start of word */
+		++i;
 
-	switch(head ? layoutTable.headerF : layoutTable.footerF)
+	while(i < end && xlate_fold[(byte) text[i]] != 0)
 	{
-	case 0:					/* None */
-	case 1:					/* Left Justified */
-		renderMargin(minLmarg);
-		break;
-	case 2:					/* Centre justified */
-		renderMargin(minLmarg + (width / 2) - (length / 2));
-		break;
-	case 3:					/* Right justified */
-		renderMargin(width - length);
-		break;
+		c = xlate_fold[(byte) text[i++]];
+		if(c > 1 && chars++ < MAX_WORD)
+			len += xlateChar(c, &word[len]);
 	}
 
-	renderLine(line);
+	word[len] = 0;
+	*pos = i;
+
+	return len;
 }
 
 /*------------------------------------------------------------------------------- */
-void newPage()
+void initLine(Line *line, char *text, unsigned start)
 {
-	if(format == Html)
-	{
-		if(bold)	printf("</b>");
-		if(underline)	printf("</u>");
-		if(sub)		printf("</sub>");
-		if(super)	printf("</sup>");
-	}
+	line->text = text;
+	line->start = start;
+	line->end = start;
+	line->fill = NULL;
+	line->padFrom = start;
+	line->spaces = 0;
+	line->pads = 0;
+	line->margin = 0;
+	line->pageBreak = false;
+}
 
-	if(maxLines && lineNo < maxLines)
-		while(lineNo++ <= maxLines)
-			renderLine("");
+/*------------------------------------------------------------------------------- */
+void addRenderer(Format format, FILE *fp)
+{
+	Renderer *r = &renderers[rendererCount++];
 
-/*	renderLine(""); */
-	renderHeaderFooter(footerPara, false);
-/*	renderLine(""); */
-	++pageNo;
-	lineNo = 2;
-	renderHeaderFooter(headerPara, true);
-	/*renderLine(""); */
+	r->format = format;
+	r->fp = fp;
+	r->bold = false;
+	r->sub = false;
+	r->super = false;
+	r->underline = false;
 
 	if(format == Html)
 	{
-		if(bold)	printf("<b>");
-		if(underline)	printf("<u>");
-		if(sub)		printf("<sub>");
-		if(super)	printf("<sup>");
+		r->newLine = "<br>\n";
+		r->space = "&nbsp;";
+		r->paraStart = "<p>";
+		r->paraEnd = "</p>";
+	}
+	else
+	{
+		r->newLine = format == Text ? "\n" : "";
+		r->space = " ";
+		r->paraStart = "";
+		r->paraEnd = "";
 	}
 }
 
 /*------------------------------------------------------------------------------- */
-void printLeftPara(ParaTable *parTab)
-{
-	char	lineBuf[512];
-	char	*lineBufPtr;
-	bool	indentLine;
-	int	col;
-	int	lastSpace;
-	char	*lastSpacePtr;
-	int		lastCol = 0;  // SNG, suppress spurious warning
-	/*int	maxWidth; */
-	int	lMarg;
-	int	rMarg;
-	bool	newPageFlag;
+/* The functions below write to the current renderer, rd. The layout calls */
+/* the render...() functions further down, which repeat them for each output. */
 
-	indentLine = true;			/* first line is indent line */
+void renderChar(unsigned c)
+{
+	FILE *fp = rd->fp;
+	Encoded *e;
+	int i;
 
-	while(textBuffer[offset] != 0)		/* until end of paragraph, for each line */
+	if(rd->format == Text)
 	{
-		if(maxLines && lineNo >= maxLines)
-			newPage();
-
-		newPageFlag = false;
-		col = 0;
-		lineBufPtr = lineBuf;
-		lastSpace = 0;
-		lastSpacePtr = NULL;
-
-		/* calculate effective margins */
-
-		if(paraCount < 3)			/* Header/footer margins seems to be garbage */
-		{
-			lMarg = 9;
-			rMarg = 79;
+		e = &encodeTable[c];
+		if(e->len == 1)
+			putc(e->seq[0], fp);			/* most of them */
+		else
+			for(i = 0; i < e->len; ++i)
+				putc(e->seq[i], fp);
+	}
+	else
+	{
+		switch(c)
+		{
+		case BOLD:
+			fputs(rd->bold ? "</b>" : "<b>", fp);
+			rd->bold = ! rd->bold;
+			break;
+		case UNDELINE:
+			fputs(rd->underline ? "</u>" : "<u>", fp);
+			rd->underline = ! rd->underline;
+			break;
+		case SUB_SCRIPT:
+			fputs(rd->sub ? "</sub>" : "<sub>", fp);
+			rd->sub = ! rd->sub;
+			break;
+		case SUPER_SCRIPT:
+			fputs(rd->super ? "</sup>" : "<sup>", fp);
+			rd->super = ! rd->super;
+			break;
+		case FORM_FEED:
+			break;
+		case SOFT_HYPEN:
+			putc('-', fp);
+			break;
+		case '<':
+			fputs("&lt;", fp);
+			break;
+		case '>':
+			fputs("&gt;", fp);
+			break;
+		case SPACE:
+		case TAB:
+			fputs("&nbsp;", fp); /* &nbsp	*/
+			break;
+		default:
+			c = xlate_utf_8[c];
+			if(c > 0x100)
+			{
+				putc(c & 0x0000ff, fp);
+				if((c & 0x0000ff) == 0xE2)
+				{
+					putc((c & 0x00ff00) >> 8, fp);
+					putc((c & 0xff0000) >> 16, fp);
+				}
+				else
+				{
+					putc((c & 0x00ff00) >> 8, fp);
+				}
+			}
+			else
+				putc(c, fp);
+			break;
+
+		}
+	}
+}
+
+/*------------------------------------------------------------------------------- */
+void renderAscii(char *str, int len)		/* in the text encoding, when text */
+{
+	if(rd->format != Text || ! encoding->wide)
+		fwrite(str, 1, len, rd->fp);
+	else
+	{
+		for(; len > 0; --len)
+		{
+			putc(*str++, rd->fp);
+			putc(0, rd->fp);
+		}
+	}
+}
+
+/*------------------------------------------------------------------------------- */
+void renderSpaces(int n)
+{
+	static char spaces[] = "                                ";
+
+	if(rd->format == Text)
+	{
+		for(; n > (int) sizeof(spaces) - 1; n -= sizeof(spaces) - 1)
+			renderAscii(spaces, sizeof(spaces) - 1);
+		if(n > 0)
+			renderAscii(spaces, n);		/* negative margin, as for a too wide header, is none */
+	}
+	else
+	{
+		while(n-- > 0)
+			fputs(rd->space, rd->fp);
+	}
+}
+
+/*------------------------------------------------------------------------------- */
+/* Draw a laid out line. Tabs are expanded to the widths worked out by the */
+/* layout, and on justified lines each padded space is written together with */
+/* its share of the padding. With s spaces sharing p pads, all but the last */
+/* space get p / s (at least 1 while pads last), and the last gets the rest. */
+void drawLine(Line *line)
+{
+	unsigned	i;
+	int			c;
+	int			fill = 0;
+	int			space = 0;
+	int			each = 0;
+	int			last = 0;
+
+	if(rd->format == Json)
+		return;						/* paragraphs only, see drawParaRecord() */
+
+	if(line->spaces > 0)
+	{
+		each = line->pads <= line->spaces ? 1 : line->pads / line->spaces;
+		last = line->pads <= line->spaces ? line->pads - line->spaces + 1 : line->pads - (line->spaces - 1) * each;
+	}
+
+	for(i = line->start; i < line->end; ++i)
+	{
+		c = (byte) line->text[i];
+
+		if(c == TAB && line->fill != NULL)
+			renderSpaces(line->fill[fill++]);
+		else if(c == SPACE && space < line->spaces && i >= line->padFrom)
+		{
+			if(++space == line->spaces)
+				renderSpaces(1 + max(last, 0));
+			else
+				renderSpaces(1 + (space <= line->pads ? each : 0));
+		}
+		else
+			renderChar(c);
+	}
+
+	renderAscii(rd->newLine, (int) strlen(rd->newLine));
+}
+
+/*------------------------------------------------------------------------------- */
+void drawString(char *str)
+{
+	Line	line;
+
+	initLine(&line, str, 0);
+	line.end = (unsigned) strlen(str);
+	drawLine(&line);
+}
+
+/*------------------------------------------------------------------------------- */
+void closeAttributes()
+{
+	if(rd->format == Html)
+	{
+		if(rd->bold)		fputs("</b>", rd->fp);
+		if(rd->underline)	fputs("</u>", rd->fp);
+		if(rd->sub)			fputs("</sub>", rd->fp);
+		if(rd->super)		fputs("</sup>", rd->fp);
+	}
+}
+
+/*------------------------------------------------------------------------------- */
+void openAttributes()
+{
+	if(rd->format == Html)
+	{
+		if(rd->bold)		fputs("<b>", rd->fp);
+		if(rd->underline)	fputs("<u>", rd->fp);
+		if(rd->sub)			fputs("<sub>", rd->fp);
+		if(rd->super)		fputs("<sup>", rd->fp);
+	}
+}
+
+/*------------------------------------------------------------------------------- */
+void drawMargin(int leftPad)
+{
+	if(rd->format == Json)
+		return;
+
+	closeAttributes();
+	renderSpaces(leftPad);
+	openAttributes();
+}
+
+/*------------------------------------------------------------------------------- */
+/* JSON Lines output. Each paragraph is one record of its text, without the */
+/* highlighting, which is given as spans of characters instead. The records */
+/* are written straight from the text of the document, nothing is buffered. */
+
+bool isJsonChar(int c)
+{
+	return (c < BOLD || c > SUPER_SCRIPT) && c != SOFT_HYPEN;
+}
+
+/*------------------------------------------------------------------------------- */
+void jsonText(char *text, unsigned from, unsigned to)
+{
+	FILE	*fp = rd->fp;
+	char	seq[4];
+	int		c, len;
+
+	putc('"', fp);
+
+	for(; from < to; ++from)
+	{
+		c = (byte) text[from];
+
+		if(! isJsonChar(c))
+			continue;
+		else if(c == TAB)
+			fputs("\\t", fp);
+		else if(c == FORM_FEED)
+			fputs("\\f", fp);
+		else if(c == '"' || c == '\\')
+		{
+			putc('\\', fp);
+			putc(c, fp);
+		}
+		else
+		{
+			len = xlateChar(c, seq);
+			if(len == 1 && (byte) seq[0] >= 0x80)
+				fprintf(fp, "\\u%04x", (byte) seq[0]);		/* Latin-1 in the table, not UTF-8 */
+			else
+				fwrite(seq, 1, len, fp);
+		}
+	}
+
+	putc('"', fp);
+}
+
+/*------------------------------------------------------------------------------- */
+void jsonName(FILE *fp, char *name)
+{
+	putc('"', fp);
+
+	for(; *name; ++name)
+	{
+		if(*name == '"' || *name == '\\')
+			putc('\\', fp);
+		if((byte) *name < SPACE)
+			fprintf(fp, "\\u%04x", (byte) *name);
+		else
+			putc(*name, fp);
+	}
+
+	putc('"', fp);
+}
+
+/*------------------------------------------------------------------------------- */
+void drawSpan(int attr, unsigned start, unsigned end, bool *first)
+{
+	static char *names[] = { "bold", "underline", "sub", "super" };
+
+	if(end > start)
+	{
+		fprintf(rd->fp, "%s{\"attr\":\"%s\",\"start\":%u,\"end\":%u}", *first ? "" : ",", names[attr], start, end);
+		*first = false;
+	}
+}
+
+/*------------------------------------------------------------------------------- */
+/* Spans of the highlighting toggled on and off in text, in characters of the */
+/* text as jsonText() writes it. Highlighting ends with the paragraph. */
+void drawSpans(char *text, unsigned from, unsigned to)
+{
+	unsigned	start[4];
+	bool		on[4] = { false, false, false, false };
+	bool		first = true;
+	unsigned	pos = 0;
+	int			c, a;
+
+	fputs(",\"spans\":[", rd->fp);
+
+	for(; from < to; ++from)
+	{
+		c = (byte) text[from];
+
+		if(c >= BOLD && c <= SUPER_SCRIPT)
+		{
+			a = c - BOLD;
+			if(on[a])
+				drawSpan(a, start[a], pos, &first);
+			else
+				start[a] = pos;
+			on[a] = ! on[a];
+		}
+		else if(isJsonChar(c))
+			++pos;
+	}
+
+	for(a = 0; a < 4; ++a)
+		if(on[a])
+			drawSpan(a, start[a], pos, &first);
+
+	putc(']', rd->fp);
+}
+
+/*------------------------------------------------------------------------------- */
+void drawTabs(int table)
+{
+	static char *types[] = { "left", "centre", "right", "decimal" };
+	TabHeader	*pt;
+	TabEntry	*pe;
+	int			i;
+
+	fputs(",\"tabs\":[", rd->fp);
+
+	if((pt = findTabTable(table)) != NULL)
+	{
+		pe = (TabEntry*) pt + 1;
+		for(i = 0; i < tabCount(pt); ++i)
+			fprintf(rd->fp, "%s{\"pos\":%d,\"type\":\"%s\"}", i > 0 ? "," : "", pe[i].pos, pe[i].type < 4 ? types[pe[i].type] : "left");
+	}
+
+	putc(']', rd->fp);
+}
+
+/*------------------------------------------------------------------------------- */
+/* The paragraph just laid out, from paraText to offset */
+void drawParaRecord()
+{
+	static char *justif[] = { "left", "centre", "right" };
+	FILE *fp = rd->fp;
+
+	fputs("{\"type\":\"paragraph\",\"file\":", fp);
+	jsonName(fp, docName);
+	fprintf(fp, ",\"para\":%d,\"page\":%d,\"left\":%d,\"indent\":%d,\"right\":%d,\"justify\":\"%s\"",
+		paraCount - 2, paraPage, paraTab->leftMarg, paraTab->indentMarg, paraTab->rightMarg,
+		paraTab->justif <= JUST_RIGHT ? justif[paraTab->justif] : "left");
+	drawTabs(paraTab->tabTable);
+	fputs(",\"text\":", fp);
+	jsonText(textBuffer, paraText, offset);
+	drawSpans(textBuffer, paraText, offset);
+	fputs("}\n", fp);
+}
+
+/*------------------------------------------------------------------------------- */
+/* The document, from the layout table, and its page header and footer */
+void drawDocRecord()
+{
+	static char *align[] = { "none", "left", "centre", "right" };
+	FILE *fp = rd->fp;
+
+	fputs("{\"type\":\"document\",\"file\":", fp);
+	jsonName(fp, docName);
+	fputs(",\"header\":", fp);
+	jsonText(headerPara, 0, (unsigned) strlen(headerPara));
+	fputs(",\"footer\":", fp);
+	jsonText(footerPara, 0, (unsigned) strlen(footerPara));
+	fprintf(fp, ",\"pageLength\":%d,\"topMargin\":%d,\"bottomMargin\":%d,\"lineGap\":%d,\"startPage\":%d,\"displayMode\":%d,\"colour\":%d,\"wordCount\":%d",
+		layoutTable.pageLen, layoutTable.topMargin, layoutTable.bottomMarg, layoutTable.lineGap,
+		layoutTable.startPage, layoutTable.dispMode, layoutTable.color, layoutTable.wordCount);
+	fprintf(fp, ",\"headerAlign\":\"%s\",\"footerAlign\":\"%s\",\"headerMargin\":%d,\"footerMargin\":%d,\"headerBold\":%s,\"footerBold\":%s}\n",
+		layoutTable.headerF < 4 ? align[layoutTable.headerF] : "none", layoutTable.footerF < 4 ? align[layoutTable.footerF] : "none",
+		layoutTable.headerMarg, layoutTable.footerMarg, layoutTable.headerBold ? "true" : "false", layoutTable.footerBold ? "true" : "false");
+}
+
+/*------------------------------------------------------------------------------- */
+/* While recording, the render...() functions below also append what they */
+/* render to layoutRec, which replayLayout() can later render again. */
+
+void putRecord(unsigned value, int bytes)
+{
+	if(! recording && pipeOut == NULL)
+		return;
+
+	if(layoutRecLen + bytes > layoutRecAlloc)
+	{
+		layoutRecAlloc = max(layoutRecAlloc * 2, ARENA_BLOCK);
+		layoutRec = safe_realloc(layoutRec, layoutRecAlloc);
+	}
+
+	while(bytes-- > 0)
+		layoutRec[layoutRecLen++] = (byte) (value >> (bytes * 8));
+}
+
+/*------------------------------------------------------------------------------- */
+/* Send the records so far to the renderer, preceded by their length */
+void sendLayout()
+{
+	byte len[4];
+
+	len[0] = (byte) (layoutRecLen >> 24);
+	len[1] = (byte) (layoutRecLen >> 16);
+	len[2] = (byte) (layoutRecLen >> 8);
+	len[3] = (byte) layoutRecLen;
+
+	fwrite(len, 1, sizeof(len), pipeOut);
+	fwrite(layoutRec, 1, layoutRecLen, pipeOut);
+	fflush(pipeOut);
+
+	layoutRecLen = 0;
+}
+
+/*------------------------------------------------------------------------------- */
+/* A line is recorded as start, end, padFrom (long), spaces, pads (word), */
+/* followed by the number of tab widths (word) and the widths (byte). No */
+/* widths means tabs render as a single space. */
+void recordLine(Line *line)
+{
+	unsigned	i;
+	int			tabs = 0;
+
+	if(! recording && pipeOut == NULL)
+		return;
+
+	if(line->fill != NULL)
+		for(i = line->start; i < line->end; ++i)
+			if(line->text[i] == TAB)
+				++tabs;
+
+	putRecord(L_LINE, 1);
+	putRecord(line->start, 4);
+	putRecord(line->end, 4);
+	putRecord(line->padFrom, 4);
+	putRecord(line->spaces, 2);
+	putRecord(line->pads, 2);
+	putRecord(tabs, 2);
+
+	for(i = 0; i < (unsigned) tabs; ++i)
+		putRecord(line->fill[i], 1);
+}
+
+/*------------------------------------------------------------------------------- */
+/* Count a line of chars laid out against the budget of the document, see */
+/* --max-lines etc. The layout stops when overBudget is set. The CPU time is */
+/* only looked at now and then, as it takes a system call. */
+void spend(unsigned chars)
+{
+	++docLines;
+	docOutput += chars;
+
+	if(overBudget != NULL)
+		return;
+
+	if(budgetLines > 0 && docLines > budgetLines)
+		overBudget = "lines";
+	else if(budgetOutput > 0 && docOutput > budgetOutput)
+		overBudget = "output";
+	else if(budgetTime > 0 && (docLines & 255) == 0 && clock() - docStart > budgetTime * CLOCKS_PER_SEC)
+		overBudget = "time";
+}
+
+/*------------------------------------------------------------------------------- */
+void renderLine(Line *line)
+{
+	spend(line->end - line->start + line->pads + max(line->margin, 0));
+	recordLine(line);
+	++lineNo;
+
+	for(rd = renderers; rd < &renderers[rendererCount]; ++rd)
+		drawLine(line);
+}
+
+/*------------------------------------------------------------------------------- */
+void renderString(char *str)
+{
+	char *p = str;
+
+	putRecord(L_STRING, 1);
+	do
+		putRecord((byte) *p, 1);
+	while(*p++);
+
+	spend((unsigned) (p - str) - 1);
+
+	++lineNo;
+
+	for(rd = renderers; rd < &renderers[rendererCount]; ++rd)
+		drawString(str);
+}
+
+/*------------------------------------------------------------------------------- */
+void renderMargin(int leftPad)
+{
+	putRecord(L_MARGIN, 1);
+	putRecord(leftPad & 0xffff, 2);
+
+	for(rd = renderers; rd < &renderers[rendererCount]; ++rd)
+		drawMargin(leftPad);
+}
+
+/*------------------------------------------------------------------------------- */
+void renderParaStart()
+{
+	putRecord(L_PARA_START, 1);
+
+	for(rd = renderers; rd < &renderers[rendererCount]; ++rd)
+		fputs(rd->paraStart, rd->fp);
+}
+
+/*------------------------------------------------------------------------------- */
+void renderParaEnd()
+{
+	putRecord(L_PARA_END, 1);
+
+	if(pipeOut != NULL && layoutRecLen >= PIPE_CHUNK)
+		sendLayout();
+
+	for(rd = renderers; rd < &renderers[rendererCount]; ++rd)
+	{
+		if(rd->format == Json)
+			drawParaRecord();
+		else
+			fputs(rd->paraEnd, rd->fp);
+	}
+}
+
+/*------------------------------------------------------------------------------- */
+void renderDocInfo()					/* only JSON Lines has a record of the document */
+{
+	for(rd = renderers; rd < &renderers[rendererCount]; ++rd)
+		if(rd->format == Json)
+			drawDocRecord();
+}
+
+/*------------------------------------------------------------------------------- */
+void renderResetAttributes()			/* highlighting ends with the paragraph */
+{
+	putRecord(L_RESET, 1);
+
+	for(rd = renderers; rd < &renderers[rendererCount]; ++rd)
+	{
+		closeAttributes();
+		rd->bold = false;
+		rd->sub = false;
+		rd->super = false;
+		rd->underline = false;
+	}
+}
+
+/*------------------------------------------------------------------------------- */
+void renderCloseAttributes()
+{
+	putRecord(L_CLOSE, 1);
+
+	for(rd = renderers; rd < &renderers[rendererCount]; ++rd)
+		closeAttributes();
+}
+
+/*------------------------------------------------------------------------------- */
+void renderOpenAttributes()
+{
+	putRecord(L_OPEN, 1);
+
+	for(rd = renderers; rd < &renderers[rendererCount]; ++rd)
+		openAttributes();
+}
+
+/*------------------------------------------------------------------------------- */
+void renderHeaderFooter(char *str, bool head)
+{
+	char *pLine = hfLine;
+	bool useBold = false;
+	int width, length;
+
+	if((head && layoutTable.headerF == 0) || (!head && layoutTable.footerF == 0))
+		return;
+
+	putRecord(head ? L_HEADER : L_FOOTER, 1);
+
+	*pLine = 0;
+
+	width = maxRmarg - minLmarg;
+
+	if((head && layoutTable.headerBold) || (! head && layoutTable.footerBold))
+	{
+		*pLine++ = BOLD;
+		useBold = true;
+	}
+
+	while(*str)
+	{
+		if(str[0] == 'n' && str[1] == 'n' && str[2] == 'n')			/* digit page number? */
+		{
+			sprintf(pLine, "%d", pageNo);
+			while(*pLine)
+				++pLine;
+
+			str = &str[3];																					/* advance source pointer after 'nnn' */
+		}
+		else if(str[0] == 'a' && str[1] == 'a' && str[2] == 'a')	/* alpha page number? */
+		{
+			sprintf(pLine, "%d", pageNo);
+			while(*pLine)
+				++pLine;
+
+			str = &str[3];																					/* advance source pointer after 'nnn' */
+		}
+		else if(str[0] == 'r' && str[1] == 'r' && str[2] == 'r')	/* roman page number? */
+		{
+			sprintf(pLine, "%d", pageNo);
+			while(*pLine)
+				++pLine;
+
+			str = &str[3];																					/* advance source pointer after 'nnn' */
+		}
+		else
+			*pLine++ = *str++;
+	}
+
+	if(useBold)
+		*pLine++ = BOLD;
+
+	*pLine = 0;
+
+	length = (int) strlen(hfLine);
+
+	if(useBold)
+		length -= 2;
+
+	switch(head ? layoutTable.headerF : layoutTable.footerF)
+	{
+	case 0:					/* None */
+	case 1:					/* Left Justified */
+		renderMargin(minLmarg);
+		break;
+	case 2:					/* Centre justified */
+		renderMargin(minLmarg + (width / 2) - (length / 2));
+		break;
+	case 3:					/* Right justified */
+		renderMargin(width - length);
+		break;
+	}
+
+	renderString(hfLine);
+}
+
+/*------------------------------------------------------------------------------- */
+void newPage()
+{
+	if(unpaged)
+		return;
+
+	renderCloseAttributes();
+
+	if(maxLines && lineNo < maxLines)
+		while(lineNo++ <= maxLines)
+			renderString("");
+
+/*	renderString(""); */
+	renderHeaderFooter(footerPara, false);
+/*	renderString(""); */
+	++pageNo;
+	lineNo = 2;
+	putRecord(L_PAGE, 1);
+	putRecord(pageNo, 2);
+	renderHeaderFooter(headerPara, true);
+	/*renderString(""); */
+
+	renderOpenAttributes();
+}
+
+/*------------------------------------------------------------------------------- */
+unsigned hashMore(unsigned h, char *data, unsigned len)		/* FNV-1a, continued from h */
+{
+	while(len-- > 0)
+	{
+		h ^= (byte) *data++;
+		h *= 16777619u;
+	}
+
+	return h;
+}
+
+/*------------------------------------------------------------------------------- */
+unsigned hashBytes(char *data, unsigned len)
+{
+	return hashMore(2166136261u, data, len);
+}
+
+/*------------------------------------------------------------------------------- */
+/* Paragraph cache, see --para-cache. The same paragraph, with the same margins, */
+/* justification and tabs, always breaks into the same lines, wherever it is. */
+/* Boilerplate that is in many documents is laid out once, and its lines are */
+/* replayed after that. A paragraph is only kept the second time it is seen, */
+/* so paragraphs that are only used once don't push out those that are not. */
+
+/* Hash of the paragraph at offset, of textLen, with its margins, justification */
+/* and the tab entries of its tab table */
+unsigned memoHash(ParaTable *parTab, unsigned textLen, byte *tabs, unsigned tabLen)
+{
+	byte key[4];
+
+	key[0] = parTab->leftMarg;
+	key[1] = parTab->indentMarg;
+	key[2] = parTab->rightMarg;
+	key[3] = parTab->justif;
+
+	return hashMore(hashMore(hashBytes((char *) key, sizeof(key)), (char *) tabs, tabLen), &textBuffer[offset], textLen);
+}
+
+/*------------------------------------------------------------------------------- */
+/* Keep the line just broken, while the paragraph is kept */
+void memoLine(Line *line, unsigned paraStart)
+{
+	MemoLine	*ml;
+	unsigned	i;
+
+	if(memoLineCount == memoLineAlloc)
+	{
+		memoLineAlloc = max(memoLineAlloc * 2, 64);
+		memoLines = safe_realloc(memoLines, memoLineAlloc * sizeof(MemoLine));
+	}
+
+	ml = &memoLines[memoLineCount++];
+	ml->start = line->start - paraStart;
+	ml->end = line->end - paraStart;
+	ml->padFrom = line->padFrom - paraStart;
+	ml->spaces = line->spaces;
+	ml->pads = line->pads;
+	ml->margin = line->margin;
+	ml->pageBreak = line->pageBreak;
+	ml->fill = memoFillLen;
+
+	if(line->fill != NULL)
+		for(i = line->start; i < line->end; ++i)
+			if(line->text[i] == TAB)
+			{
+				if(memoFillLen == memoFillAlloc)
+				{
+					memoFillAlloc = max(memoFillAlloc * 2, 256);
+					memoFills = safe_realloc(memoFills, memoFillAlloc);
+				}
+				memoFills[memoFillLen] = line->fill[memoFillLen - ml->fill];
+				++memoFillLen;
+			}
+}
+
+/*------------------------------------------------------------------------------- */
+/* Keep the paragraph laid out from paraStart, in place of what is in its slot */
+void memoKeep(ParaTable *parTab, unsigned hash, unsigned paraStart, byte *tabs, unsigned tabLen)
+{
+	ParaMemo	*m;
+	ParaMemo	**slot = &memoSlot[hash & (MEMO_SLOTS - 1)];
+	unsigned	textLen = offset - paraStart;
+	unsigned	size;
+
+	size = sizeof(ParaMemo) + memoLineCount * sizeof(MemoLine) + memoFillLen + textLen + tabLen;
+	if(memoLen - (*slot != NULL ? (*slot)->size : 0) + size > memoLimit)
+		return;
+
+	if(*slot != NULL)
+	{
+		memoLen -= (*slot)->size;
+		free(*slot);
+	}
+
+	m = safe_malloc(size);
+	m->hash = hash;
+	m->textLen = textLen;
+	m->tabLen = tabLen;
+	m->leftMarg = parTab->leftMarg;
+	m->indentMarg = parTab->indentMarg;
+	m->rightMarg = parTab->rightMarg;
+	m->justif = parTab->justif;
+	m->lineCount = memoLineCount;
+	m->size = size;
+	m->lines = (MemoLine *) (m + 1);
+	m->fills = (byte *) (m->lines + memoLineCount);
+	m->text = (char *) (m->fills + memoFillLen);
+	m->tabs = (byte *) (m->text + textLen);
+
+	memcpy(m->lines, memoLines, memoLineCount * sizeof(MemoLine));
+	memcpy(m->fills, memoFills, memoFillLen);
+	memcpy(m->text, &textBuffer[paraStart], textLen);
+	memcpy(m->tabs, tabs, tabLen);
+
+	*slot = m;
+	memoLen += size;
+}
+
+/*------------------------------------------------------------------------------- */
+/* Render the lines of a paragraph kept, as printLines() would lay them out */
+void memoReplay(ParaMemo *m)
+{
+	MemoLine	*ml;
+	Line		line;
+	unsigned	paraStart = offset;
+
+	for(ml = m->lines; ml < &m->lines[m->lineCount] && overBudget == NULL; ++ml)
+	{
+		if(maxLines && lineNo >= maxLines)
+			newPage();
+
+		initLine(&line, textBuffer, paraStart + ml->start);
+		line.end = paraStart + ml->end;
+		line.padFrom = paraStart + ml->padFrom;
+		line.spaces = ml->spaces;
+		line.pads = ml->pads;
+		line.margin = ml->margin;
+		line.pageBreak = ml->pageBreak;
+		if(m->justif != JUST_CENTRE)
+			line.fill = &m->fills[ml->fill];
+
+		renderMargin(line.margin);
+		renderLine(&line);
+
+		if(line.pageBreak)
+			newPage();
+	}
+
+	offset = paraStart + m->textLen;
+}
+
+/*------------------------------------------------------------------------------- */
+/* Render the paragraph at offset from the cache, if it is there. If not, */
+/* it is noted, to be kept by memoKeep() when laid out, the second time */
+/* it is seen. */
+bool memoPara(ParaTable *parTab, unsigned *hash, byte **tabs, unsigned *tabLen)
+{
+	TabHeader	*pt;
+	ParaMemo	*m;
+	unsigned	textLen = (unsigned) strlen(&textBuffer[offset]);
+	unsigned	slot;
+
+	*tabs = NULL;
+	*tabLen = 0;
+	if((pt = findTabTable(parTab->tabTable)) != NULL)
+	{
+		*tabs = (byte *) (pt + 1);
+		*tabLen = tabCount(pt) * 2;
+	}
+
+	*hash = memoHash(parTab, textLen, *tabs, *tabLen);
+	slot = *hash & (MEMO_SLOTS - 1);
+	m = memoSlot[slot];
+	++memoLookups;
+
+	if(m != NULL && m->hash == *hash && m->textLen == textLen && m->tabLen == *tabLen
+		&& m->leftMarg == parTab->leftMarg && m->indentMarg == parTab->indentMarg
+		&& m->rightMarg == parTab->rightMarg && m->justif == parTab->justif
+		&& memcmp(m->text, &textBuffer[offset], textLen) == 0 && memcmp(m->tabs, *tabs, *tabLen) == 0)
+	{
+		++memoHits;
+		memoReplay(m);
+		return true;
+	}
+
+	memoing = memoDoor[slot] == *hash;
+	memoDoor[slot] = *hash;
+	memoLineCount = 0;
+	memoFillLen = 0;
+
+	return false;
+}
+
+/*------------------------------------------------------------------------------- */
+void memoReport()
+{
+	if(memoLimit > 0)
+		fprintf(stderr, "quill-view: paragraph cache, %u of %u paragraphs reused (%.1f%%)\n",
+			memoHits, memoLookups, memoLookups > 0 ? memoHits * 100.0 / memoLookups : 0.0);
+}
+
+/*------------------------------------------------------------------------------- */
+/* Collect the next line of the paragraph, from offset, which is moved on to */
+/* the line after. Everything needed to break and justify the line - the last */
+/* break point, the spaces after the last tab and any form feed - is noted as */
+/* the line is collected, so it is only scanned once. The justifications */
+/* differ in a few places, tested on just. It is a constant where inlined */
+/* into printLeftPara() etc., so each of them gets a loop of its own. */
+/*  */
+/* Left and right: tabs are expanded, and lines are broken at a space, for */
+/* right also at a tab or soft hyphen. A right line that is broken is padded */
+/* out to the margin, in the spaces after the last tab. */
+/* Centre: tabs are a single space and lines are centred, not indented. */
+SPECIALIZED void breakLine(ParaTable *parTab, Line *line, bool indentLine, int just)
+{
+	int			c;
+	int			col;
+	int			width = 0;				/* characters on line, incl. tab expansion */
+	int			spaces = 0;				/* spaces since last tab */
+	int			nextTab;
+	int			lastSpace = -1;
+	int			lastWidth = 0;
+	int			lastCol = 0;
+	int			lastSpaces = 0;
+	int			formFeed = -1;
+	int			lMarg;
+	int			rMarg;
+	unsigned	tab = offset;
+	unsigned	lastTab = offset;
+	bool		tabWrapFlag = false;
+	bool		justify;
+
+	initLine(line, textBuffer, offset);
+	if(just != JUST_CENTRE)
+		line->fill = lineFill;
+
+	/* calculate effective margins, a centred line is within 0..rMarg */
+
+	lMarg = indentLine && just != JUST_CENTRE ? parTab->indentMarg : parTab->leftMarg;
+	rMarg = just == JUST_CENTRE ? parTab->rightMarg - lMarg : parTab->rightMarg;
+	col = just == JUST_CENTRE ? 0 : lMarg;
+
+	/* while within right margin, collect words and build line */
+	/* remember last space so we can back out to fit last word within rMarg */
+
+	do {
+		c = textBuffer[offset];
+
+		if(c == FORM_FEED && formFeed < 0)
+			formFeed = offset;
+
+		if(just == JUST_RIGHT && (c == SPACE || c == TAB || c == SOFT_HYPEN))
+		{
+			lastSpace = offset;					/* break before it */
+			lastWidth = width;
+			lastCol = col;
+			lastSpaces = spaces;
+			lastTab = tab;
+		}
+
+		if(c == TAB && just != JUST_CENTRE)		/* expand tabs */
+		{
+			nextTab = getNextTab(parTab->tabTable, col + 1);
+
+			if(nextTab < 0) {
+				tabWrapFlag = true;				/* wraps to next line */
+				line->end = offset++;			/* tab consumed, not shown */
+				break;							/* no more tabs, wrap line here */
+			}
+
+			if(just == JUST_RIGHT)
+				nextTab = max(col, min(nextTab, rMarg));
+			*line->fill++ = nextTab - col;
+			width += nextTab - col;
+			col = nextTab;
+			spaces = 0;							/* can't pad before a tab, only after */
+			tab = offset;
+		}
+		else
+		{
+			++width;
+
+			if(isPrintable(c) || c == TAB)
+				++col;							/* advance column  */
+			if(c == SPACE)
+			{
+				++spaces;
+				if(just != JUST_RIGHT)
+				{
+					lastSpace = offset;			/* break after it */
+					lastCol = col;
+				}
+			}
+		}
+		line->end = ++offset;
+	} while(textBuffer[offset] != END_PARA && col < rMarg);
+
+	justify = just == JUST_RIGHT && textBuffer[offset] != END_PARA && ! tabWrapFlag;
+
+	if(just == JUST_RIGHT && ! justify)
+		;										/* last line, or ended with tab, is left as is */
+	else if(col >= rMarg && lastSpace >= 0		/* break line, unless that would not move on */
+		&& ((unsigned) lastSpace > line->start || (just != JUST_CENTRE && textBuffer[lastSpace] == SPACE)))
+	{
+		line->end = lastSpace;					/* back up to last space */
+
+		if(just == JUST_RIGHT)
+		{
+			spaces = lastSpaces;
+			tab = lastTab;
+
+			while(lastWidth > 1 && line->end > line->start + 1 && textBuffer[line->end - 1] == SPACE)
+			{
+				--line->end;					/* strip of trailing spaces */
+				--lastWidth;
+				--lastCol;
+				--spaces;
+			}
+		}
+
+		offset = lastSpace;						/* advance on after last space, so we don't loop forever */
+		col = lastCol;
+		if(just != JUST_CENTRE)
+			while(textBuffer[offset] == SPACE)	/* skip initial spaces on line */
+				++offset;
+	}
+
+	if(justify)
+	{
+		line->padFrom = tab;					/* right justify line, by padding the spaces after the last tab */
+		line->spaces = spaces;
+		line->pads = max(rMarg - col, 0);
+	}
+
+	if(just == JUST_CENTRE)
+		line->margin = lMarg + (rMarg / 2) - (col / 2);
+	else
+		line->margin = lMarg;
+
+	line->pageBreak = just == JUST_RIGHT ? formFeed >= 0 && (unsigned) formFeed < line->end : formFeed >= 0;
+	line->fill = just == JUST_CENTRE ? NULL : lineFill;
+}
+
+/*------------------------------------------------------------------------------- */
+SPECIALIZED void printLines(ParaTable *parTab, int just)
+{
+	Line		line;
+	bool		indentLine = true;			/* first line is indent line */
+	unsigned	paraStart = offset;
+
+	while(textBuffer[offset] != END_PARA && overBudget == NULL)		/* until end of paragraph, for each line */
+	{
+		if(maxLines && lineNo >= maxLines)
+			newPage();
+
+		breakLine(parTab, &line, indentLine, just);
+		indentLine = false;
+		if(memoing)
+			memoLine(&line, paraStart);
+
+		renderMargin(line.margin);
+		renderLine(&line);
+
+		if(line.pageBreak)
+			newPage();
+	}
+}
+
+/*------------------------------------------------------------------------------- */
+void printLeftPara(ParaTable *parTab)
+{
+	printLines(parTab, JUST_LEFT);
+}
+
+/*------------------------------------------------------------------------------- */
+void printCenterPara(ParaTable *parTab)
+{
+	printLines(parTab, JUST_CENTRE);
+}
+
+/*------------------------------------------------------------------------------- */
+void printRightPara(ParaTable *parTab)
+{
+	printLines(parTab, JUST_RIGHT);
+}
+
+/*------------------------------------------------------------------------------- */
+void printPara(ParaTable *parTab)
+{
+	unsigned	hash, tabLen;
+	byte		*tabs;
+
+	++paraCount;
+
+	paraTab = parTab;
+	paraText = offset;
+	paraPage = pageNo + (maxLines && lineNo >= maxLines && textBuffer[offset] != 0);	/* first line may start a page */
+
+	renderParaStart();
+
+	if(textBuffer[offset] == 0)
+	{
+		if(paraCount > 2)
+			renderString("");		/* empty paragaph needs a new line */
+	}
+	else if(memoLimit > 0 && memoPara(parTab, &hash, &tabs, &tabLen))
+		renderResetAttributes();
+	else
+	{
+		switch(parTab->justif)
+		{
+		case JUST_LEFT:
+			printLeftPara(parTab);
+			break;
+		case JUST_CENTRE:
+			printCenterPara(parTab);
+			break;
+		case JUST_RIGHT:
+			printRightPara(parTab);
+			break;
+		}
+		if(memoing)
+		{
+			memoing = false;
+			if(overBudget == NULL)				/* only what was laid out in full */
+				memoKeep(parTab, hash, paraText, tabs, tabLen);
+		}
+		renderResetAttributes();
+	}
+
+	renderParaEnd();
+}
+
+/*------------------------------------------------------------------------------- */
+/* All memory that lives as long as one document comes from the arena. It is */
+/* released in one go by arenaReset() when the document is done, and kept for */
+/* the next document, so a batch run makes no allocator calls once warmed up. */
+void *arenaAlloc(unsigned size)
+{
+	ArenaBlock	*block;
+	void		*p;
+	char		msg[64];
+
+	if(size > ARENA_MAX)
+	{
+		sprintf(msg, "quill-view: cant allocate %u bytes of memory\n", size);
+		error(msg);
+	}
+
+	size = (size + 7) & ~7;
+
+	if(arena == NULL || arena->size - arena->used < size)
+	{
+		block = safe_malloc(sizeof(ArenaBlock) + max(size, ARENA_BLOCK));
+		block->next = arena;
+		block->size = max(size, ARENA_BLOCK);
+		block->used = 0;
+		arena = block;
+	}
+
+	p = (char *) (arena + 1) + arena->used;
+	arena->used += size;
+
+	return p;
+}
+
+/*------------------------------------------------------------------------------- */
+void arenaReset()
+{
+	ArenaBlock	*block;
+	unsigned	total = 0;
+
+	if(arena == NULL)
+		return;
+
+	if(arena->next == NULL && arena->size <= max(arenaLimit, ARENA_BLOCK))
+	{
+		arena->used = 0;						/* everything fitted, just rewind */
+		return;
+	}
+
+	/* the document needed more than one block, or more than the high-water */
+	/* mark. Replace them with a single block big enough for it, but no */
+	/* bigger than the high-water mark */
+
+	while(arena != NULL)
+	{
+		block = arena;
+		total += block->used;
+		arena = block->next;
+		free(block);
+	}
+
+	arenaAlloc(min(total, arenaLimit));
+	arena->used = 0;
+}
+
+/*------------------------------------------------------------------------------- */
+/* Time in microseconds, for the trace, see --trace */
+double traceNow()
+{
+#if defined(HAVE_FORK) && defined(CLOCK_MONOTONIC)
+	struct timespec ts;
+
+	if(traceFp == NULL)
+		return 0;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1e6 + ts.tv_nsec / 1e3;
+#else
+	return traceFp == NULL ? 0 : clock() * (1e6 / CLOCKS_PER_SEC);
+#endif
+}
+
+/*------------------------------------------------------------------------------- */
+/* Write the spans kept to the trace file, in Chrome's trace event format */
+void traceFlush()
+{
+	TraceSpan *sp;
+
+	for(sp = traceSpans; sp < &traceSpans[traceCount]; ++sp)
+	{
+		fprintf(traceFp, "{\"name\":\"%s\",\"ph\":\"X\",\"pid\":%d,\"tid\":%d,\"ts\":%.1f,\"dur\":%.1f",
+			sp->name, traceId, worker, sp->start, sp->end - sp->start);
+
+		if(sp->file != NULL)
+		{
+			fputs(",\"args\":{\"file\":", traceFp);
+			jsonName(traceFp, sp->file);
+			fprintf(traceFp, ",\"size\":%u}", sp->size);
+		}
+		fputs("},\n", traceFp);
+	}
+
+	traceCount = 0;
+}
+
+/*------------------------------------------------------------------------------- */
+/* Keep a span from start until now, of the document being worked on. Spans */
+/* are kept in memory, and only written when there are TRACE_SPANS of them */
+/* or the work is done, so tracing costs little more than reading the clock. */
+void traceSpan(char *name, double start)
+{
+	TraceSpan *sp;
+
+	if(traceFp == NULL)
+		return;
+
+	if(traceCount == TRACE_SPANS)
+		traceFlush();
+
+	sp = &traceSpans[traceCount++];
+	sp->name = name;
+	sp->file = traceDoc;
+	sp->size = traceSize;
+	sp->start = start;
+	sp->end = traceNow();
+}
+
+/*------------------------------------------------------------------------------- */
+void traceThread()						/* names the row of the worker in the trace */
+{
+	fprintf(traceFp, "{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":%d,\"tid\":%d,\"args\":{\"name\":\"", traceId, worker);
+	if(worker == 0)
+		fputs("main", traceFp);
+	else
+		fprintf(traceFp, "worker %d", worker);
+	fputs("\"}},\n", traceFp);
+}
+
+/*------------------------------------------------------------------------------- */
+/* End the trace, false if it can't be written. Also called at exit, after */
+/* error(), so the failure is only reported: io_error() would not return */
+bool traceClose()
+{
+	bool ok;
+
+	if(traceFp == NULL)
+		return true;
+
+	traceFlush();
+	fprintf(traceFp, "{\"name\":\"process_name\",\"ph\":\"M\",\"pid\":%d,\"args\":{\"name\":\"%s\"}}\n]\n", traceId, ME);
+
+	if(! (ok = fclose(traceFp) == 0))
+		fprintf(stderr, "quill-view: can't write file %s, '%s'\n", traceName, strerror(errno));
+	traceFp = NULL;
+
+	return ok;
+}
+
+/*------------------------------------------------------------------------------- */
+void traceExit()
+{
+	traceClose();
+}
+
+/*------------------------------------------------------------------------------- */
+void traceOpen(char *name)
+{
+	if((traceFp = fopen(name, "w")) == NULL)
+		io_error("quill-view: can't open file %s, '%s'\n", name);
+
+	traceName = name;
+	traceSpans = safe_malloc(TRACE_SPANS * sizeof(TraceSpan));
+#ifdef HAVE_FORK
+	traceId = (int) getpid();
+#endif
+
+	fputs("[\n", traceFp);
+	traceThread();
+	atexit(traceExit);					/* after error(), see finish(). Worker processes end with _exit() */
+}
+
+/*------------------------------------------------------------------------------- */
+/* Read a whole file into the arena, in one read when the size is known */
+char *readFile(FILE *fp, unsigned *size)
+{
+	char	*data = NULL;
+	char	*p;
+	long	len;
+	size_t	bytes;
+	unsigned alloc = 0;
+
+	if(fseek(fp, 0, SEEK_END) == 0 && (len = ftell(fp)) >= 0 && fseek(fp, 0, SEEK_SET) == 0)
+	{
+		p = arenaAlloc((unsigned) len + 1);
+		*size = (unsigned) fread(p, 1, len, fp);
+		return p;
+	}
+
+	/* a pipe, read in growing chunks */
+
+	*size = 0;
+	do
+	{
+		if(*size == alloc)
+		{
+			alloc = max(alloc * 2, ARENA_BLOCK);
+			data = safe_realloc(data, alloc);
+		}
+		bytes = fread(&data[*size], 1, alloc - *size, fp);
+		*size += (unsigned) bytes;
+	}
+	while(bytes > 0);
+
+	p = arenaAlloc(*size + 1);
+	memcpy(p, data, *size);
+	free(data);
+
+	return p;
+}
+
+/*------------------------------------------------------------------------------- */
+/* Copy part of the document, what is beyond the end of the file reads as zero */
+void copyBytes(void *dst, unsigned pos, unsigned len)
+{
+	unsigned n = pos < docSize ? min(len, docSize - pos) : 0;
+
+	if(streamFile != NULL)
+	{
+		fseek(streamFile, pos, SEEK_SET);
+		n = (unsigned) fread(dst, 1, n, streamFile);
+	}
+	else
+		memcpy(dst, &docData[pos], n);
+
+	memset((char *) dst + n, 0, len - n);
+}
+
+/*------------------------------------------------------------------------------- */
+/* Hash the paragraph table on offset, for getPara() */
+void indexParaTable()
+{
+	unsigned h;
+	int i;
+
+	for(paraIndexSize = 16; paraIndexSize < parTableHead.used * 2u; paraIndexSize *= 2)
+		;
+	paraIndex = arenaAlloc(paraIndexSize * sizeof(unsigned));
+	memset(paraIndex, 0, paraIndexSize * sizeof(unsigned));
+
+	for(i = 1; i < parTableHead.used; ++i)		/* skip first entry (set i = 1), always garbage? */
+	{
+		for(h = paraSlot(parTable[i].offset); paraIndex[h] != 0; h = (h + 1) & (paraIndexSize - 1))
+			if(parTable[paraIndex[h]].offset == parTable[i].offset)
+				break;
+
+		if(paraIndex[h] == 0)					/* the first entry of an offset is used */
+			paraIndex[h] = i;
+	}
+}
+
+/*------------------------------------------------------------------------------- */
+/* A Quill file header, in host byte order, of a file of size bytes. A */
+/* truncated file reads as zeros, but not when most of it is missing, as for */
+/* a damaged header. Shared by decodeDocument() and --info, see infoFile() */
+bool headerValid(Header *h, unsigned size)
+{
+	return size >= (unsigned) HeaderSize && memcmp(h->id, "vrm1qdf0", sizeof(h->id)) == 0
+		&& h->textLen >= (unsigned) HeaderSize && h->textLen <= size + MAX_MISSING
+		&& h->textLen <= NO_ENTRY - h->paraLen - h->freeLen - LayoutTableSize;
+}
+
+/*------------------------------------------------------------------------------- */
+/* ...and the paragraph table head after the text */
+bool paraTableValid(ParaTableHead *ph, unsigned size)
+{
+	return ph->used == 0 || (ph->size >= ParaTableSize && (unsigned) ph->size * ph->used <= size + MAX_MISSING);
+}
+
+/*------------------------------------------------------------------------------- */
+/* Decode the tables of the document in docData, or streamFile. The text is */
+/* used where it is, and only copied if the file is truncated. When streaming, */
+/* it is read as needed into the window instead. */
+bool decodeDocument()
+{
+	unsigned	pos;
+	unsigned	size = docSize;
+	int			i;
+
+	textBase = 0;
+	windowLen = 0;
+	docHashed = false;
+	overBudget = NULL;
+
+	/* 20 bytes header, make sure it's a Quill file  */
+
+	copyBytes(&header, 0, HeaderSize);
+#ifndef _QDOS_
+	header.len = BEword(header.len);
+	header.textLen = BElong(header.textLen);
+	header.paraLen = BEword(header.paraLen);
+	header.freeLen = BEword(header.freeLen);
+	header.layoutLen = BEword(header.layoutLen);
+#endif
+
+	if(! headerValid(&header, size))
+		return false;
+
+	/* text buffer, a truncated file reads as empty paragraphs */
+
+	if(streamFile != NULL)
+	{
+		if(window == NULL)
+		{
+			windowAlloc = STREAM_CHUNK * 2;
+			window = safe_malloc(windowAlloc);
+			windowFill = safe_malloc(windowAlloc);
+		}
+		textBuffer = window;
+	}
+	else if(size - HeaderSize >= header.textLen)
+		textBuffer = &docData[HeaderSize];
+	else
+	{
+		textBuffer = arenaAlloc(header.textLen);
+		copyBytes(textBuffer, HeaderSize, header.textLen);
+	}
+
+	/* paragraph table head, and the used parts of the paragraph table, */
+	/* translated from big to little endian */
+
+	copyBytes(&parTableHead, header.textLen, ParaTableHeadSize);
+#ifndef _QDOS_
+	parTableHead.size = BEword(parTableHead.size);
+	parTableHead.gran = BEword(parTableHead.gran);
+	parTableHead.used = BEword(parTableHead.used);
+	parTableHead.alloc = BEword(parTableHead.alloc);
+#endif
+
+	if(! paraTableValid(&parTableHead, size))
+		return false;
+
+	parTable = arenaAlloc(parTableHead.size * parTableHead.used);
+	copyBytes(parTable, header.textLen + ParaTableHeadSize, parTableHead.size * parTableHead.used);
+
+#ifndef _QDOS_
+	for(i = 0; i < parTableHead.used; ++i)
+	{
+		parTable[i].offset = BElong(parTable[i].offset);
+		parTable[i].paraLen = BEword(parTable[i].paraLen);
+	}
+#endif
+
+	indexParaTable();
+
+	/* layout table head, and the tab entries table after it */
+
+	pos = header.textLen + header.freeLen + header.paraLen;
+	copyBytes(&layoutTable, pos, LayoutTableSize);
+#ifndef _QDOS_
+	layoutTable.wordCount = BEword(layoutTable.wordCount);
+	layoutTable.maxTabSize = BEword(layoutTable.maxTabSize);
+	layoutTable.tabSize = BEword(layoutTable.tabSize);
+#endif
+
+	tabTable = arenaAlloc(layoutTable.tabSize + TabHeaderSize);
+	copyBytes(tabTable, pos + LayoutTableSize, layoutTable.tabSize);
+	memset((char *) tabTable + layoutTable.tabSize, 0, TabHeaderSize);	/* always an end of table */
+
+	offset = 0;
+
+	return true;
+}
+
+/*------------------------------------------------------------------------------- */
+/* A document already in memory, which must be kept until it is unloaded */
+bool setDocument(char *data, unsigned size)
+{
+	streamFile = NULL;
+	docData = data;
+	docSize = size;
+
+	return decodeDocument();
+}
+
+/*------------------------------------------------------------------------------- */
+bool loadDocument(FILE *fp)
+{
+	unsigned	size;
+	char		*data;
+	double		start = traceNow();
+	bool		ok;
+
+	data = readFile(fp, &size);
+	traceSize = size;
+	traceSpan("load", start);
+
+	start = traceNow();
+	ok = setDocument(data, size);
+	traceSpan("decode", start);
+
+	return ok;
+}
+
+/*------------------------------------------------------------------------------- */
+/* Open a document to be streamed. Only the tables, which are small, are read */
+/* here. The text is read a paragraph at a time by streamPara() as it is laid */
+/* out, so memory use doesn't grow with the document. A pipe can't be */
+/* streamed, as the tables are after the text, and is loaded instead. */
+bool openDocument(FILE *fp)
+{
+	long	len;
+	double	start;
+	bool	ok;
+
+	if(fseek(fp, 0, SEEK_END) != 0 || (len = ftell(fp)) < 0)
+		return loadDocument(fp);
+
+	streamFile = fp;
+	docData = NULL;
+	docSize = traceSize = (unsigned) len;
+
+	start = traceNow();
+	ok = decodeDocument();
+	traceSpan("decode", start);
+	if(! ok)
+		return false;
+
+	fseek(fp, HeaderSize, SEEK_SET);
+	return true;
+}
+
+/*------------------------------------------------------------------------------- */
+/* Make sure the window holds the whole paragraph at offset. The window only */
+/* moves when more must be read, to start at the paragraph. */
+void streamPara()
+{
+	unsigned	scanned;
+	unsigned	bytes;
+
+	if(streamFile == NULL)
+		return;
+
+	for(scanned = offset; memchr(&window[scanned], END_PARA, windowLen - scanned) == NULL; )
+	{
+		if(offset > 0)
+		{
+			memmove(window, &window[offset], windowLen - offset);
+			windowLen -= offset;
+			textBase += offset;
+			offset = 0;
+		}
+
+		if(windowLen + STREAM_CHUNK > windowAlloc)
+		{
+			windowAlloc *= 2;
+			window = safe_realloc(window, windowAlloc);
+			windowFill = safe_realloc(windowFill, windowAlloc);
+			textBuffer = window;
+			lineFill = windowFill;
+		}
+
+		/* the text area, as loadDocument() reads it, then zeros */
+
+		scanned = windowLen;
+		bytes = textBase + windowLen < header.textLen ? min(STREAM_CHUNK, header.textLen - textBase - windowLen) : 0;
+		bytes = (unsigned) fread(&window[windowLen], 1, bytes, streamFile);
+		if(bytes == 0)
+			window[windowLen++] = 0;
+		windowLen += bytes;
+	}
+}
+
+/*------------------------------------------------------------------------------- */
+void unloadDocument()
+{
+	arenaReset();
+
+	streamFile = NULL;
+	textBuffer = NULL;
+	parTable = NULL;
+	tabTable = NULL;
+}
+
+/*------------------------------------------------------------------------------- */
+/* Drop the document after error() went back to recovery in the middle of it */
+void abandonDocument()
+{
+	recovery = NULL;
+	recording = false;
+	memoing = false;
+	unloadDocument();
+}
+
+/*------------------------------------------------------------------------------- */
+bool fileStat(char *name, unsigned *size, unsigned *mtime)
+{
+	struct stat st;
+
+	if(stat(name, &st) != 0)
+		return false;
+
+	*size = (unsigned) st.st_size;
+	*mtime = (unsigned) st.st_mtime;
+
+	return true;
+}
+
+/*------------------------------------------------------------------------------- */
+/* Hash of the document file, worked out once, or known from the container */
+unsigned documentHash()
+{
+	if(! docHashed)
+	{
+		docHash = hashBytes(docData, docSize);
+		docHashed = true;
+	}
+
+	return docHash;
+}
+
+/*------------------------------------------------------------------------------- */
+unsigned getRecord(byte **p, int bytes)
+{
+	unsigned value = 0;
+
+	while(bytes-- > 0)
+		value = (value << 8) | *(*p)++;
+
+	return value;
+}
+
+/*------------------------------------------------------------------------------- */
+/* Render the layout records of the document, as recorded by the render...() */
+/* functions, with the text moved delta bytes. With render false, only check */
+/* that they are sane, so that a damaged cache file is never rendered. */
+bool replayLayout(byte *p, unsigned len, int delta, bool render)
+{
+	byte	*end = p + len;
+	byte	*str;
+	Line	line;
+	int		n;
+
+	while(p < end)
+	{
+		switch(*p++)
+		{
+		case L_PARA_START:
+			if(render)
+				renderParaStart();
+			break;
+		case L_PARA_END:
+			if(render)
+				renderParaEnd();
+			break;
+		case L_RESET:
+			if(render)
+				renderResetAttributes();
+			break;
+		case L_CLOSE:
+			if(render)
+				renderCloseAttributes();
+			break;
+		case L_OPEN:
+			if(render)
+				renderOpenAttributes();
+			break;
+		case L_MARGIN:
+			if(end - p < 2)
+				return false;
+			n = getRecord(&p, 2);
+			if(render)
+				renderMargin(n & 0x8000 ? n - 0x10000 : n);
+			break;
+		case L_LINE:
+			if(end - p < 18)
+				return false;
+			initLine(&line, textBuffer, getRecord(&p, 4) + delta);
+			line.end = getRecord(&p, 4) + delta;
+			line.padFrom = getRecord(&p, 4) + delta;
+			line.spaces = getRecord(&p, 2);
+			line.pads = getRecord(&p, 2);
+			n = getRecord(&p, 2);
+			if(end - p < n)
+				return false;
+			line.fill = n > 0 ? p : NULL;
+			p += n;
+			if(render)
+			{
+				if(line.start > line.end || line.end > header.textLen)
+					return false;
+				renderLine(&line);
+			}
+			break;
+		case L_STRING:
+			str = p;
+			if((p = memchr(str, 0, end - str)) == NULL)
+				return false;
+			++p;
+			if(render)
+				renderString((char *) str);
+			break;
+		case L_PAGE:
+			if(end - p < 2)
+				return false;
+			n = getRecord(&p, 2);
+			if(render)
+			{
+				putRecord(L_PAGE, 1);			/* only recorded, for a new cache */
+				putRecord(n, 2);
+			}
+			break;
+		case L_HEADER:
+		case L_FOOTER:
+			if(render)
+				putRecord(p[-1], 1);
+			break;
+		default:
+			return false;
+		}
+	}
+
+	return true;
+}
+
+/*------------------------------------------------------------------------------- */
+void swapLayoutCache(LayoutCacheHeader *lh, LayoutCachePara *lp, unsigned paraCount)
+{
+#ifndef _QDOS_
+	if(lh != NULL)
+	{
+		lh->hash = BElong(lh->hash);
+		lh->size = BElong(lh->size);
+		lh->context = BElong(lh->context);
+		lh->recordLen = BElong(lh->recordLen);
+		lh->paraCount = BElong(lh->paraCount);
+	}
+
+	for(; paraCount > 0; --paraCount, ++lp)
+	{
+		lp->hash = BElong(lp->hash);
+		lp->offset = BElong(lp->offset);
+		lp->record = BElong(lp->record);
+		lp->lineNo = BElong(lp->lineNo);
+		lp->pageNo = BElong(lp->pageNo);
+	}
+#endif
+}
+
+/*------------------------------------------------------------------------------- */
+/* Cache files are named after the hash of the source file name, so that the */
+/* layout of an earlier version of a document is found. */
+void layoutCacheName(char *srcfile, char *name)
+{
+	if(strlen(cacheDir) > MAX_PATH)
+		error("quill-view: cache directory name too long\n");
+
+	sprintf(name, "%s/%08x.qvl", cacheDir, hashBytes(srcfile, (unsigned) strlen(srcfile)));
+}
+
+/*------------------------------------------------------------------------------- */
+/* Hash of what the layout of all paragraphs depends on, other than their own */
+/* text and paragraph table entry */
+unsigned layoutContext()
+{
+	int			margins[3];
+	unsigned	h;
+
+	margins[0] = minLmarg;
+	margins[1] = maxRmarg;
+	margins[2] = maxLines;
+
+	h = hashBytes((char *) &layoutTable, LayoutTableSize);
+	h = hashMore(h, (char *) tabTable, layoutTable.tabSize);
+	h = hashMore(h, headerPara, (unsigned) strlen(headerPara) + 1);
+	h = hashMore(h, footerPara, (unsigned) strlen(footerPara) + 1);
+
+	return hashMore(h, (char *) margins, sizeof(margins));
+}
+
+/*------------------------------------------------------------------------------- */
+unsigned hashPara(ParaTable *parTab, unsigned from, unsigned to)
+{
+	byte entry[5];
+
+	entry[0] = parTab->leftMarg;
+	entry[1] = parTab->indentMarg;
+	entry[2] = parTab->rightMarg;
+	entry[3] = parTab->justif;
+	entry[4] = parTab->tabTable;
+
+	return hashMore(hashBytes((char *) entry, sizeof(entry)), &textBuffer[from], to - from);
+}
+
+/*------------------------------------------------------------------------------- */
+void addLayoutPara(unsigned hash, unsigned offset, ParaTable *parTab)
+{
+	if(layoutParaCount == layoutParaAlloc)
+	{
+		layoutParaAlloc = max(layoutParaAlloc * 2, 256);
+		layoutPara = safe_realloc(layoutPara, layoutParaAlloc * LayoutCacheParaSize);
+		layoutParaTab = safe_realloc(layoutParaTab, layoutParaAlloc * sizeof(ParaTable *));
+	}
+
+	layoutPara[layoutParaCount].hash = hash;
+	layoutPara[layoutParaCount].offset = offset;
+	layoutParaTab[layoutParaCount++] = parTab;
+}
+
+/*------------------------------------------------------------------------------- */
+/* Hash the paragraphs from offset on, in the same way as layoutDocument() */
+/* walks them. A last entry is added for the end of the document. */
+void scanParagraphs(ParaTable *parTab)
+{
+	ParaTable	*newPara;
+	unsigned	pos = offset;
+	unsigned	end;
+
+	layoutParaCount = 0;
+
+	for(;;)
+	{
+		for(end = pos; textBuffer[end] != END_PARA; ++end)
+			;
+		addLayoutPara(hashPara(parTab, pos, end), pos, parTab);
+
+		if(end >= header.textLen - HeaderSize)
+			break;
+
+		pos = end + 1;
+		if((newPara = getPara(pos)) != NULL)
+			parTab = newPara;
+	}
+
+	addLayoutPara(0, end, NULL);
+	--layoutParaCount;
+}
+
+/*------------------------------------------------------------------------------- */
+/* The layout of a document, with its paragraph table, from the cache */
+bool readLayoutCache(char *srcfile, CachedLayout *cl)
+{
+	LayoutCacheHeader	*lh = &cl->head;
+	char				name[MAX_PATH + 16];
+	unsigned			size, mtime, i;
+	bool				ok;
+	FILE				*fp;
+
+	layoutCacheName(srcfile, name);
+
+	if(! fileStat(name, &size, &mtime) || (fp = fopen(name, "rb")) == NULL)
+		return false;
+
+	ok = fread(lh, 1, LayoutCacheHeaderSize, fp) == LayoutCacheHeaderSize;
+	swapLayoutCache(lh, NULL, 0);
+
+	ok = ok && memcmp(lh->id, "qvlayout", sizeof(lh->id)) == 0
+		&& strncmp(lh->version, LAYOUT_VERSION, sizeof(lh->version)) == 0
+		&& lh->recordLen < size && lh->paraCount < size / LayoutCacheParaSize
+		&& size == LayoutCacheHeaderSize + lh->recordLen + (lh->paraCount + 1) * LayoutCacheParaSize;
+
+	if(ok)
+	{
+		cl->rec = arenaAlloc(lh->recordLen);
+		cl->para = arenaAlloc((lh->paraCount + 1) * LayoutCacheParaSize);
+
+		ok = fread(cl->rec, 1, lh->recordLen, fp) == lh->recordLen
+			&& fread(cl->para, LayoutCacheParaSize, lh->paraCount + 1, fp) == lh->paraCount + 1
+			&& replayLayout(cl->rec, lh->recordLen, 0, false);
+
+		swapLayoutCache(NULL, cl->para, lh->paraCount + 1);
+
+		for(i = 0; ok && i <= lh->paraCount; ++i)
+			ok = cl->para[i].record <= lh->recordLen;
+	}
+
+	fclose(fp);
+
+	return ok;
+}
+
+/*------------------------------------------------------------------------------- */
+/* Save the recorded layout. A cache that can't be written is no error, the */
+/* translation is done anyway. */
+void writeLayoutCache(char *srcfile)
+{
+	LayoutCacheHeader	lh;
+	char				name[MAX_PATH + 16];
+	char				tmpFile[MAX_PATH + 32];
+	FILE				*fp;
+	bool				ok;
+
+	layoutCacheName(srcfile, name);
+#ifdef HAVE_FORK
+	sprintf(tmpFile, "%s.%d.tmp", name, (int) getpid());		/* workers may write the same file */
+#else
+	sprintf(tmpFile, "%s.tmp", name);
+#endif
+
+	if((fp = fopen(tmpFile, "wb")) == NULL)
+		return;
+
+	memset(&lh, 0, LayoutCacheHeaderSize);
+	memcpy(lh.id, "qvlayout", sizeof(lh.id));
+	strncpy(lh.version, LAYOUT_VERSION, sizeof(lh.version) - 1);
+	lh.hash = documentHash();
+	lh.size = docSize;
+	lh.context = layoutContext();
+	lh.recordLen = layoutRecLen;
+	lh.paraCount = layoutParaCount;
+	swapLayoutCache(&lh, layoutPara, layoutParaCount + 1);
+
+	ok = fwrite(&lh, 1, LayoutCacheHeaderSize, fp) == LayoutCacheHeaderSize;
+	ok &= fwrite(layoutRec, 1, layoutRecLen, fp) == layoutRecLen;
+	ok &= fwrite(layoutPara, LayoutCacheParaSize, layoutParaCount + 1, fp) == layoutParaCount + 1;
+	ok &= fclose(fp) == 0;
+
+#ifdef _WIN32
+	if(ok)
+		remove(name);
+#endif
+	if(! ok || rename(tmpFile, name) != 0)
+		remove(tmpFile);
+}
+
+/*------------------------------------------------------------------------------- */
+/* Use the old layout of paragraphs from, and including, old paragraph j for */
+/* paragraph k and on. Records and paragraphs are copied with text offsets */
+/* moved to where the paragraphs are now. */
+void reuseLayout(CachedLayout *old, unsigned j, unsigned k)
+{
+	unsigned	base = layoutRecLen;
+	unsigned	first = old->para[j].record;
+
+	replayLayout(&old->rec[first], old->head.recordLen - first, layoutPara[k].offset - old->para[j].offset, true);
+
+	for(; j <= old->head.paraCount; ++j, ++k)
+	{
+		layoutPara[k].record = base + old->para[j].record - first;
+		layoutPara[k].lineNo = old->para[j].lineNo;
+		layoutPara[k].pageNo = old->para[j].pageNo;
+	}
+}
+
+/*------------------------------------------------------------------------------- */
+/* Copy of the paragraph at offset, which is moved past it */
+char *copyPara()
+{
+	unsigned	len;
+	char		*para;
+
+	streamPara();
+
+	len = (unsigned) strlen(&textBuffer[offset]);
+	para = arenaAlloc(len + 1);
+	memcpy(para, &textBuffer[offset], len + 1);
+
+	offset += len + 1;
+	++paraCount;
+
+	return para;
+}
+
+/*------------------------------------------------------------------------------- */
+/* Set up the layout of the loaded document, up to its first paragraph after */
+/* header and footer. Returns the paragraph table entry of it. */
+ParaTable *startLayout()
+{
+	static ParaTable defaultPara = { 0, 0, 0, 9, 14, 69, 0, 0, 0 };
+	ParaTable	*currPara;
+	int			i;
+
+	lineNo = 2;
+	pageNo = 1;
+	paraCount = 0;
+
+	docLines = 0;
+	docOutput = 0;
+	docStart = budgetTime > 0 ? clock() : 0;
+	overBudget = NULL;
+
+	maxLines = layoutTable.pageLen - layoutTable.topMargin - layoutTable.bottomMarg;
+	if(layoutTable.pageLen == 0 || maxLines < 1)
+		maxLines = 0;		/* disable automatic page breaks */
+	else if(layoutTable.footerF)
+		maxLines -= 1;
+
+	currPara = getPara(offset);
+
+	/* get header and footer */
+
+	headerPara = copyPara();
+	footerPara = copyPara();
+	renderDocInfo();
+
+	/* room for header or footer with page numbers, and tabs of the longest line */
+
+	hfLine = arenaAlloc((unsigned) max(strlen(headerPara), strlen(footerPara)) * 4 + 4);
+	lineFill = streamFile != NULL ? windowFill : arenaAlloc(header.textLen);
+
+	/* find out the smallest and largest margins in document, used for header/footer */
+
+	minLmarg = 100;
+	maxRmarg = 0;
+
+	for(i = 3; i < parTableHead.used; ++i)					/* skip first entry (set *i = 1), always garbage? */
+	{
+		minLmarg = min(parTable[i].leftMarg, minLmarg);
+		maxRmarg = max(parTable[i].rightMarg, maxRmarg);
+	}
+
+	currPara = getPara(textBase + offset);
+
+	return currPara != NULL ? currPara : &defaultPara;
+}
+
+/*------------------------------------------------------------------------------- */
+/* Lay out the document. With recording on, the layout of an earlier version */
+/* of it, old, is used for paragraphs that have not changed: those at start, */
+/* and those at end once they start on the same line and page as they did. */
+void layoutDocument(CachedLayout *old)
+{
+	ParaTable	*currPara = startLayout();
+	unsigned	n, m, k;
+	unsigned	same = 0;
+	unsigned	tail = 0;
+	int			ch, done;
+
+	done = 0;
+	k = 0;
+	n = m = 0;
+
+	if(recording)
+	{
+		scanParagraphs(currPara);
+		n = layoutParaCount;
+
+		if(old != NULL && old->head.context == layoutContext())
+		{
+			m = old->head.paraCount;
+
+			for(same = 0; same < n && same < m && layoutPara[same].hash == old->para[same].hash; ++same)
+				;
+			for(tail = 0; tail < n - same && tail < m - same && layoutPara[n - 1 - tail].hash == old->para[m - 1 - tail].hash; ++tail)
+				;
+
+			if(same > 0)						/* unchanged at start, as it was */
+			{
+				replayLayout(old->rec, old->para[same].record, 0, true);
+
+				for(k = 0; k < same; ++k)
+					layoutPara[k] = old->para[k];
+
+				lineNo = old->para[same].lineNo;
+				pageNo = old->para[same].pageNo;
+				paraCount += same;
+				offset = layoutPara[same].offset;
+				currPara = layoutParaTab[same];
+				done = same == n;
+			}
+		}
+	}
+
+	while(! done && overBudget == NULL)
+	{
+		if(recording)
+		{
+			layoutPara[k].record = layoutRecLen;
+			layoutPara[k].lineNo = lineNo;
+			layoutPara[k].pageNo = pageNo;
+
+			if(tail > 0 && k >= n - tail && lineNo == (int) old->para[k - n + m].lineNo && pageNo == (int) old->para[k - n + m].pageNo)
+			{
+				reuseLayout(old, k - n + m, k);			/* back in step after the change */
+				return;
+			}
+			++k;
+		}
+
+		streamPara();
+		printPara(currPara);
+
+		ch = getByte();
+
+		switch(ch)
+		{
+		case EOF:
+			done = true;
+			break;
+		case END_PARA:
+			{
+				ParaTable *newPara = getPara(textBase + offset);
+				currPara = newPara ? newPara : currPara;
+				break;
+			}
+		case END_TEXT:
+			done = 1;
+			break;
+		}
+	}
+
+	if(recording)
+	{
+		layoutPara[n].record = layoutRecLen;
+		layoutPara[n].lineNo = lineNo;
+		layoutPara[n].pageNo = pageNo;
+	}
+}
+
+/*------------------------------------------------------------------------------- */
+/* Render the layout records sent by pipeLayout() until there are no more */
+void renderPiped(FILE *in)
+{
+	byte		len[4];
+	byte		*rec = NULL;
+	unsigned	n, alloc = 0;
+
+	while(fread(len, 1, sizeof(len), in) == sizeof(len))
+	{
+		n = ((unsigned) len[0] << 24) | (len[1] << 16) | (len[2] << 8) | len[3];
+
+		if(n > alloc)
+		{
+			alloc = max(n, PIPE_CHUNK * 2);
+			rec = safe_realloc(rec, alloc);
+		}
+
+		if(fread(rec, 1, n, in) != n || ! replayLayout(rec, n, 0, true))
+			break;
+	}
+
+	free(rec);
+}
+
+/*------------------------------------------------------------------------------- */
+/* Lay out the document in this process and render it in another, which is */
+/* sent the layout as the records of the layout cache a chunk at a time, so */
+/* that layout and rendering run side by side and output starts early. */
+void pipeLayout()
+{
+#ifdef HAVE_FORK
+	int		fd[2];
+	int		count = rendererCount;
+	int		status;
+	pid_t	pid;
+
+	for(rd = renderers; rd < &renderers[rendererCount]; ++rd)
+		fflush(rd->fp);								/* or both would write what is buffered */
+
+	if(pipe(fd) == 0)
+	{
+		if((pid = fork()) == 0)
+		{
+			close(fd[1]);
+			renderPiped(fdopen(fd[0], "rb"));
+			for(rd = renderers; rd < &renderers[rendererCount]; ++rd)
+				fflush(rd->fp);
+			_exit(0);
+		}
+
+		close(fd[0]);
+
+		if(pid > 0)
+		{
+			pipeOut = fdopen(fd[1], "wb");
+			rendererCount = 0;						/* rendered by the other process */
+			layoutRecLen = 0;
+
+			layoutDocument(NULL);
+			sendLayout();
+
+			fclose(pipeOut);
+			pipeOut = NULL;
+			rendererCount = count;
+
+			waitpid(pid, &status, 0);
+			return;
+		}
+
+		close(fd[1]);
+	}
+#endif
+
+	layoutDocument(NULL);							/* can't, do it all here */
+}
+
+/*------------------------------------------------------------------------------- */
+void renderHead()
+{
+	for(rd = renderers; rd < &renderers[rendererCount]; ++rd)
+	{
+		if(rd->format == Text)	/* Show text version */
+			fwrite(encoding->bom, 1, encoding->bomLen, rd->fp);
+		else if(rd->format == Html)
+			fputs(HTML_HEAD, rd->fp);
+	}
+}
+
+/*------------------------------------------------------------------------------- */
+/* The document was cut short, said on stderr and, in JSON Lines, as a record */
+/* in place of the rest of it */
+void budgetError(char *srcfile)
+{
+	fprintf(stderr, "quill-view: %s is over the %s budget, translation cut short\n", srcfile, overBudget);
+
+	for(rd = renderers; rd < &renderers[rendererCount]; ++rd)
+		if(rd->format == Json)
+		{
+			fputs("{\"type\":\"error\",\"file\":", rd->fp);
+			jsonName(rd->fp, srcfile);
+			fprintf(rd->fp, ",\"error\":\"over the %s budget\",\"lines\":%u,\"output\":%u}\n", overBudget, docLines, docOutput);
+		}
+}
+
+/*------------------------------------------------------------------------------- */
+/* Translate the loaded document to all renderers */
+void renderDocument(char *srcfile)
+{
+	CachedLayout	old;
+	bool			replayable = streamFile == NULL;		/* streamed text is gone when done */
+	bool			cached;
+	double			start;
+
+	if(rendererCount == 0)
+		addRenderer(format, stdout);
+
+	docName = srcfile;
+	renderHead();
+
+	for(rd = renderers; rd < &renderers[rendererCount]; ++rd)
+		if(rd->format == Json)
+			replayable = false;	/* the layout records don't tell which paragraph is which */
+
+	/* and, finally, decode the actual text, or render the layout cached */
+	/* from the last time */
+
+	cached = cacheDir != NULL && replayable && readLayoutCache(srcfile, &old);
+
+	start = traceNow();
+
+	if(cached && old.head.hash == documentHash() && old.head.size == docSize)
+	{
+		replayLayout(old.rec, old.head.recordLen, 0, true);
+		traceSpan("render", start);
+	}
+	else if(pipelining && replayable && cacheDir == NULL)
+	{
+		pipeLayout();
+		traceSpan("layout", start);		/* and render, in the other process */
+	}
+	else
+	{
+		recording = cacheDir != NULL && replayable;
+		layoutRecLen = 0;
+
+		layoutDocument(cached ? &old : NULL);
+		traceSpan("layout", start);		/* rendered as laid out */
+
+		if(recording)
+		{
+			recording = false;
+			if(overBudget == NULL)
+				writeLayoutCache(srcfile);
+		}
+	}
+
+	if(overBudget != NULL)
+		budgetError(srcfile);
+
+	for(rd = renderers; rd < &renderers[rendererCount]; ++rd)
+	{
+		if(rd->format == Text)
+		{
+			char tmp[MAX_PATH + 200];
+
+			sprintf(tmp, "\n\n____________________________________________________________________\n");
+			renderAscii(tmp, (int) strlen(tmp));
+			sprintf(tmp, "File: %.*s\nTranslated by %s (compiled %s)\n", MAX_PATH, srcfile, ME, __DATE__);
+			renderAscii(tmp, (int) strlen(tmp));
+		}
+		else if(rd->format == Html)
+		{
+			char tmp[MAX_PATH + 64];
+
+			fputs(rd->paraStart, rd->fp);
+			drawString("_____________________________________________________________________________");
+			sprintf(tmp, "File: %.*s", MAX_PATH, srcfile);
+			drawString(tmp);
+			sprintf(tmp, "Translated by %s (compiled %s)", ME, __DATE__);
+			fputs(rd->paraEnd, rd->fp);
+
+			fputs(HTML_TAIL, rd->fp);
+		}
+	}
+}
+
+/*------------------------------------------------------------------------------- */
+void translate(char *srcfile)
+{
+	traceDoc = srcfile;
+
+	if(! (streaming ? openDocument(stdin) : loadDocument(stdin)))
+		error("Not a valid Quill Document\n");
+
+	renderDocument(srcfile);
+}
+
+/*------------------------------------------------------------------------------- */
+/* Move to the paragraph at text offset pos. When streaming, the text is read */
+/* from there, unless it is in the window already. */
+void seekText(unsigned pos)
+{
+	if(streamFile != NULL && (pos < textBase || pos >= textBase + windowLen))
+	{
+		fseek(streamFile, HeaderSize + pos, SEEK_SET);
+		textBase = pos;
+		windowLen = 0;
+		offset = 0;
+	}
+	else
+		offset = pos - textBase;
+}
+
+/*------------------------------------------------------------------------------- */
+/* Lay out paragraphs paraFrom to paraTo only, see --paras. Quill writes the */
+/* paragraph table with an entry for each paragraph, in order, and then the */
+/* entry of paragraph n is n + 2, after header and footer. The text is read */
+/* from there on, streamed, so the time taken is that of the paragraphs laid */
+/* out. If the table is not like that, the paragraphs before are skipped in */
+/* the text. There are no page breaks, and the page of a paragraph is 0. */
+void excerpt(char *srcfile)
+{
+	ParaTable	*currPara;
+	ParaTable	*newPara;
+	unsigned	end;
+	int			i, n;
+
+	if(! openDocument(stdin))
+		error("Not a valid Quill Document\n");
+
+	if(rendererCount == 0)
+		addRenderer(format, stdout);
+
+	docName = srcfile;
+	renderHead();
+
+	currPara = startLayout();
+	maxLines = 0;
+	unpaged = true;
+	pageNo = 0;
+
+	/* the last entry in order, without gaps, up to paragraph paraFrom */
+
+	end = textBase + offset + HeaderSize;
+	for(i = 3, n = 1; i < parTableHead.used && parTable[i].offset == end && n < paraFrom; ++i, ++n)
+		end += parTable[i].paraLen;
+
+	if(i < parTableHead.used && parTable[i].offset == end)
+	{
+		seekText(end - HeaderSize);
+		currPara = &parTable[i];
+	}
+	else
+		n = 1;							/* from the first paragraph */
+
+	end = header.textLen - HeaderSize;
+
+	for(;; ++n)
+	{
+		streamPara();
+
+		if((newPara = getPara(textBase + offset)) != NULL)
+			currPara = newPara;
+
+		if(n >= paraFrom)
+		{
+			paraCount = n + 1;			/* numbered as in a whole translation */
+			printPara(currPara);
+		}
+		else
+			offset += (unsigned) strlen(&textBuffer[offset]);
+
+		if(n == paraTo || textBase + offset >= end || overBudget != NULL)
+			break;						/* as getByte() in layoutDocument() */
+		++offset;
+	}
+
+	unpaged = false;
+
+	if(overBudget != NULL)
+		budgetError(srcfile);
+
+	for(rd = renderers; rd < &renderers[rendererCount]; ++rd)
+		if(rd->format == Html)
+			fputs(HTML_TAIL, rd->fp);
+}
+
+/*------------------------------------------------------------------------------- */
+unsigned skipHeaderFooter()		/* offset of first paragraph after header and footer */
+{
+	unsigned end = header.textLen - HeaderSize;
+	unsigned pos = 0;
+	int i;
+
+	for(i = 0; i < 2; ++i)
+	{
+		while(pos < end && textBuffer[pos] != END_PARA)
+			++pos;
+		++pos;
+	}
+
+	return pos;
+}
+
+/*------------------------------------------------------------------------------- */
+unsigned hashString(char *str)
+{
+	return hashBytes(str, (unsigned) strlen(str));
+}
+
+/*------------------------------------------------------------------------------- */
+unsigned addString(char *str)
+{
+	unsigned len = (unsigned) strlen(str) + 1;
+	unsigned pos = idxPoolLen;
+
+	if(idxPoolLen + len > idxPoolAlloc)
+	{
+		idxPoolAlloc = max(idxPoolAlloc * 2, idxPoolLen + len + 65536);
+		idxPool = safe_realloc(idxPool, idxPoolAlloc);
+	}
+
+	memcpy(&idxPool[pos], str, len);
+	idxPoolLen += len;
+
+	return pos;
+}
+
+/*------------------------------------------------------------------------------- */
+unsigned addDoc(char *name, unsigned size, unsigned mtime)
+{
+	if(idxDocCount == idxDocAlloc)
+	{
+		idxDocAlloc = idxDocAlloc ? idxDocAlloc * 2 : 1024;
+		idxDocs = safe_realloc(idxDocs, idxDocAlloc * IndexDocSize);
+	}
+
+	idxDocs[idxDocCount].name = addString(name);
+	idxDocs[idxDocCount].size = size;
+	idxDocs[idxDocCount].mtime = mtime;
+
+	return idxDocCount++;
+}
+
+/*------------------------------------------------------------------------------- */
+unsigned internTerm(char *term)
+{
+	unsigned i, mask;
+
+	if(idxTermCount * 2 >= idxHashSize)		/* keep hash table at most half full */
+	{
+		idxHashSize = idxHashSize ? idxHashSize * 2 : 4096;
+		idxHash = safe_realloc(idxHash, idxHashSize * sizeof(unsigned));
+		memset(idxHash, 0, idxHashSize * sizeof(unsigned));
+
+		for(mask = idxHashSize - 1, i = 0; i < idxTermCount; ++i)
+		{
+			unsigned slot = hashString(&idxPool[idxTermName[i]]) & mask;
+
+			while(idxHash[slot] != 0)
+				slot = (slot + 1) & mask;
+			idxHash[slot] = i + 1;
+		}
+	}
+
+	mask = idxHashSize - 1;
+	for(i = hashString(term) & mask; idxHash[i] != 0; i = (i + 1) & mask)
+		if(strcmp(&idxPool[idxTermName[idxHash[i] - 1]], term) == 0)
+			return idxHash[i] - 1;
+
+	if(idxTermCount == idxTermAlloc)
+	{
+		idxTermAlloc = idxTermAlloc ? idxTermAlloc * 2 : 4096;
+		idxTermName = safe_realloc(idxTermName, idxTermAlloc * sizeof(unsigned));
+	}
+
+	idxTermName[idxTermCount] = addString(term);
+	idxHash[i] = idxTermCount + 1;
+
+	return idxTermCount++;
+}
+
+/*------------------------------------------------------------------------------- */
+void addPosting(unsigned term, unsigned doc, int para, int word)
+{
+	if(idxOccCount == idxOccAlloc)
+	{
+		idxOccAlloc = idxOccAlloc ? idxOccAlloc * 2 : 65536;
+		idxOccs = safe_realloc(idxOccs, idxOccAlloc * sizeof(IndexOcc));
+	}
+
+	idxOccs[idxOccCount].term = term;
+	idxOccs[idxOccCount].post.doc = doc;
+	idxOccs[idxOccCount].post.para = para;
+	idxOccs[idxOccCount].post.word = word;
+	++idxOccCount;
+}
+
+/*------------------------------------------------------------------------------- */
+void indexDocument(unsigned doc)
+{
+	char		word[MAX_WORD * 3 + 1];
+	unsigned	end = header.textLen - HeaderSize;
+	unsigned	pos;
+	int			para, count;
+
+	for(pos = skipHeaderFooter(), para = 1; pos < end && textBuffer[pos] != END_TEXT; ++pos, ++para)
+	{
+		count = 0;
+		while(getWord(textBuffer, &pos, end, word) > 0)
+			addPosting(internTerm(word), doc, para, count++);
+	}
+}
+
+/*------------------------------------------------------------------------------- */
+void swapIndex(IndexDoc *docs, unsigned docCount, IndexTerm *terms, unsigned termCount, IndexPost *posts, unsigned postCount)
+{
+#ifndef _QDOS_
+	unsigned i;
+
+	for(i = 0; i < docCount; ++i)
+	{
+		docs[i].name = BElong(docs[i].name);
+		docs[i].size = BElong(docs[i].size);
+		docs[i].mtime = BElong(docs[i].mtime);
+	}
+	for(i = 0; i < termCount; ++i)
+	{
+		terms[i].name = BElong(terms[i].name);
+		terms[i].first = BElong(terms[i].first);
+		terms[i].count = BElong(terms[i].count);
+	}
+	for(i = 0; i < postCount; ++i)
+	{
+		posts[i].doc = BElong(posts[i].doc);
+		posts[i].para = BEword(posts[i].para);
+		posts[i].word = BEword(posts[i].word);
+	}
+#endif
+}
+
+/*------------------------------------------------------------------------------- */
+void swapIndexHeader(IndexHeader *ih)
+{
+#ifndef _QDOS_
+	ih->docCount = BElong(ih->docCount);
+	ih->termCount = BElong(ih->termCount);
+	ih->postCount = BElong(ih->postCount);
+	ih->stringLen = BElong(ih->stringLen);
+#endif
+}
+
+/*------------------------------------------------------------------------------- */
+bool readIndexHeader(FILE *fp, IndexHeader *ih, char *indexFile)
+{
+	if(fread(ih, 1, IndexHeaderSize, fp) != IndexHeaderSize || memcmp(ih->id, "qvindex1", sizeof(ih->id)) != 0)
+	{
+		fprintf(stderr, "quill-view: %s is not a quill-view index\n", indexFile);
+		return false;
+	}
+
+	swapIndexHeader(ih);
+	return true;
+}
+
+/*------------------------------------------------------------------------------- */
+int compareNames(const void *a, const void *b)
+{
+	return strcmp(*(char **) a, *(char **) b);
+}
+
+/*------------------------------------------------------------------------------- */
+int compareTerms(const void *a, const void *b)
+{
+	return strcmp(&idxPool[idxTermName[*(unsigned *) a]], &idxPool[idxTermName[*(unsigned *) b]]);
+}
+
+/*------------------------------------------------------------------------------- */
+int comparePosts(const void *a, const void *b)
+{
+	const IndexPost *pa = a, *pb = b;
+
+	if(pa->doc != pb->doc)
+		return pa->doc < pb->doc ? -1 : 1;
+	if(pa->para != pb->para)
+		return pa->para - pb->para;
+	return pa->word - pb->word;
+}
+
+/*------------------------------------------------------------------------------- */
+/* Bring in documents from a previous run of the index. Documents that still */
+/* exist and are unchanged are kept, and marked current so they are not read */
+/* again. Documents that were removed or changed are dropped. */
+void mergeIndex(char *indexFile, char **sorted, int count, bool *current)
+{
+	IndexHeader	ih;
+	IndexDoc	*docs;
+	IndexTerm	*terms;
+	IndexPost	*posts;
+	char		*strings;
+	char		**found;
+	char		*name;
+	unsigned	*remap;
+	unsigned	i, j, term, size, mtime;
+	FILE		*fp;
+
+	if((fp = fopen(indexFile, "rb")) == NULL)
+		return;									/* first run, nothing to merge */
+
+	if(! readIndexHeader(fp, &ih, indexFile))
+		exit(1);
+
+	docs = safe_malloc(ih.docCount * IndexDocSize + 1);
+	terms = safe_malloc(ih.termCount * IndexTermSize + 1);
+	posts = safe_malloc(ih.postCount * IndexPostSize + 1);
+	strings = safe_malloc(ih.stringLen + 1);
+	remap = safe_malloc(ih.docCount * sizeof(unsigned) + 1);
+
+	if(fread(docs, IndexDocSize, ih.docCount, fp) != ih.docCount
+	|| fread(terms, IndexTermSize, ih.termCount, fp) != ih.termCount
+	|| fread(posts, IndexPostSize, ih.postCount, fp) != ih.postCount
+	|| fread(strings, 1, ih.stringLen, fp) != ih.stringLen)
+		io_error("quill-view: can't read index %s, '%s'\n", indexFile);
+
+	fclose(fp);
+	strings[ih.stringLen] = 0;
+
+	swapIndex(docs, ih.docCount, terms, ih.termCount, posts, ih.postCount);
+
+	for(i = 0; i < ih.docCount; ++i)
+	{
+		name = &strings[docs[i].name];
+		remap[i] = NO_ENTRY;
+
+		if(! fileStat(name, &size, &mtime))
+			continue;							/* removed */
+
+		found = bsearch(&name, sorted, count, sizeof(char *), compareNames);
+		if(found != NULL)
+		{
+			if(current[found - sorted] || size != docs[i].size || mtime != docs[i].mtime)
+				continue;						/* changed, index it again */
+			current[found - sorted] = true;
+		}
+
+		remap[i] = addDoc(name, size, mtime);
+	}
+
+	for(i = 0; i < ih.termCount; ++i)
+	{
+		term = NO_ENTRY;
+
+		for(j = terms[i].first; j < terms[i].first + terms[i].count && j < ih.postCount; ++j)
+		{
+			if(posts[j].doc >= ih.docCount || remap[posts[j].doc] == NO_ENTRY)
+				continue;
+
+			if(term == NO_ENTRY)
+				term = internTerm(&strings[terms[i].name]);
+
+			addPosting(term, remap[posts[j].doc], posts[j].para, posts[j].word);
+		}
+	}
+
+	free(docs);
+	free(terms);
+	free(posts);
+	free(strings);
+	free(remap);
+}
+
+/*------------------------------------------------------------------------------- */
+void writeIndex(char *indexFile)
+{
+	IndexHeader	ih;
+	IndexDoc	doc;
+	IndexTerm	term;
+	IndexPost	*posts;
+	unsigned	*order;
+	unsigned	*first;
+	unsigned	i, t, pos, name;
+	char		tmpFile[MAX_PATH + 8];
+	FILE		*fp;
+
+	/* sort terms, so that queries can do a binary search */
+
+	order = safe_malloc(idxTermCount * sizeof(unsigned) + 1);
+	for(i = 0; i < idxTermCount; ++i)
+		order[i] = i;
+	qsort(order, idxTermCount, sizeof(unsigned), compareTerms);
+
+	/* group postings by term. Postings were added in document order, and the */
+	/* distribution below keeps that order within each term. */
+
+	first = safe_malloc(idxTermCount * sizeof(unsigned) + 1);
+	memset(first, 0, idxTermCount * sizeof(unsigned));
+
+	for(i = 0; i < idxOccCount; ++i)
+		++first[idxOccs[i].term];
+
+	memcpy(&ih.id, "qvindex1", sizeof(ih.id));
+	ih.docCount = idxDocCount;
+	ih.termCount = 0;
+	ih.postCount = idxOccCount;
+	ih.stringLen = 0;
+
+	for(i = 0; i < idxDocCount; ++i)
+		ih.stringLen += (unsigned) strlen(&idxPool[idxDocs[i].name]) + 1;
+
+	for(i = 0, pos = 0; i < idxTermCount; ++i)
+	{
+		t = order[i];
+		if(first[t] > 0)						/* all postings may have been dropped by merge */
+		{
+			++ih.termCount;
+			ih.stringLen += (unsigned) strlen(&idxPool[idxTermName[t]]) + 1;
+		}
+
+		pos += first[t];						/* turn count into start of term */
+		first[t] = pos - first[t];
+	}
+
+	posts = safe_malloc(idxOccCount * IndexPostSize + 1);
+	for(i = 0; i < idxOccCount; ++i)
+		posts[first[idxOccs[i].term]++] = idxOccs[i].post;
+
+	/* write to a temporary file, and replace the index when complete */
+
+	sprintf(tmpFile, "%.*s.tmp", MAX_PATH - 1, indexFile);
+	if((fp = fopen(tmpFile, "wb")) == NULL)
+		io_error("quill-view: can't open file %s, '%s'\n", tmpFile);
+
+	swapIndexHeader(&ih);
+	fwrite(&ih, 1, IndexHeaderSize, fp);
+	swapIndexHeader(&ih);
+
+	for(i = 0, name = 0; i < idxDocCount; ++i)
+	{
+		doc = idxDocs[i];
+		doc.name = name;
+		name += (unsigned) strlen(&idxPool[idxDocs[i].name]) + 1;
+		swapIndex(&doc, 1, NULL, 0, NULL, 0);
+		fwrite(&doc, 1, IndexDocSize, fp);
+	}
+
+	for(i = 0, t = 0; i < idxTermCount; ++i)
+	{
+		if(first[order[i]] == t)
+			continue;							/* no postings */
+
+		term.name = name;
+		term.first = t;
+		term.count = first[order[i]] - t;		/* first[] now points past the last posting */
+		name += (unsigned) strlen(&idxPool[idxTermName[order[i]]]) + 1;
+		t = first[order[i]];
+		swapIndex(NULL, 0, &term, 1, NULL, 0);
+		fwrite(&term, 1, IndexTermSize, fp);
+	}
+
+	swapIndex(NULL, 0, NULL, 0, posts, idxOccCount);
+	fwrite(posts, IndexPostSize, idxOccCount, fp);
+
+	for(i = 0; i < idxDocCount; ++i)
+		fwrite(&idxPool[idxDocs[i].name], 1, strlen(&idxPool[idxDocs[i].name]) + 1, fp);
+
+	for(i = 0, t = 0; i < idxTermCount; ++i)
+	{
+		if(first[order[i]] == t)
+			continue;
+		t = first[order[i]];
+		fwrite(&idxPool[idxTermName[order[i]]], 1, strlen(&idxPool[idxTermName[order[i]]]) + 1, fp);
+	}
+
+	if(fclose(fp) != 0)
+		io_error("quill-view: can't write file %s, '%s'\n", tmpFile);
+
+#ifdef _WIN32
+	remove(indexFile);
+#endif
+	if(rename(tmpFile, indexFile) != 0)
+		io_error("quill-view: can't replace index %s, '%s'\n", indexFile);
+
+	free(order);
+	free(first);
+	free(posts);
+}
+/*------------------------------------------------------------------------------- */
+void buildIndex(char *indexFile, int count, char **files)
+{
+	char		**sorted;
+	char		**found;
+	bool		*current;
+	unsigned	size, mtime;
+	FILE		*fp;
+	int			i;
+
+	sorted = safe_malloc(count * sizeof(char *));
+	memcpy(sorted, files, count * sizeof(char *));
+	qsort(sorted, count, sizeof(char *), compareNames);
+
+	current = safe_malloc(count * sizeof(bool));
+	memset(current, 0, count * sizeof(bool));
+
+	mergeIndex(indexFile, sorted, count, current);
+
+	for(i = 0; i < count; ++i)
+	{
+		found = bsearch(&files[i], sorted, count, sizeof(char *), compareNames);
+		if(current[found - sorted])
+			continue;							/* unchanged, or given twice */
+		current[found - sorted] = true;
+
+		if(! fileStat(files[i], &size, &mtime) || (fp = fopen(files[i], "rb")) == NULL)
+		{
+			fprintf(stderr, "quill-view: can't open file %s, '%s'\n", files[i], strerror(errno));
+			continue;
+		}
+
+		if(loadDocument(fp))
+		{
+			indexDocument(addDoc(files[i], size, mtime));
+			unloadDocument();
+		}
+		else
+			fprintf(stderr, "quill-view: %s is not a valid Quill Document\n", files[i]);
+
+		fclose(fp);
+	}
+
+	writeIndex(indexFile);
+
+	free(sorted);
+	free(current);
+}
+
+/*------------------------------------------------------------------------------- */
+void readString(FILE *fp, long pos, char *str, int size)
+{
+	int c;
+
+	fseek(fp, pos, SEEK_SET);
+	while(--size > 0 && (c = getc(fp)) != EOF && c != 0)
+		*str++ = c;
+	*str = 0;
+}
+
+/*------------------------------------------------------------------------------- */
+/* Binary search the term table on disk, and read the postings of the term. */
+/* Returns the number of postings, 0 if the term is not in the index. */
+unsigned readPostings(FILE *fp, IndexHeader *ih, char *word, IndexPost **posts)
+{
+	IndexTerm	term;
+	char		str[MAX_WORD * 3 + 1];
+	long		termPos = IndexHeaderSize + (long) ih->docCount * IndexDocSize;
+	long		postPos = termPos + (long) ih->termCount * IndexTermSize;
+	long		strPos = postPos + (long) ih->postCount * IndexPostSize;
+	unsigned	lo = 0, hi = ih->termCount, mid;
+	int			cmp;
+
+	while(lo < hi)
+	{
+		mid = (lo + hi) / 2;
+
+		fseek(fp, termPos + (long) mid * IndexTermSize, SEEK_SET);
+		if(fread(&term, 1, IndexTermSize, fp) != IndexTermSize)
+			break;
+		swapIndex(NULL, 0, &term, 1, NULL, 0);
+		readString(fp, strPos + term.name, str, sizeof(str));
+
+		if((cmp = strcmp(word, str)) == 0)
+		{
+			*posts = safe_malloc(term.count * IndexPostSize + 1);
+			fseek(fp, postPos + (long) term.first * IndexPostSize, SEEK_SET);
+			if(fread(*posts, IndexPostSize, term.count, fp) != term.count)
+				return 0;
+
+			swapIndex(NULL, 0, NULL, 0, *posts, term.count);
+			return term.count;
+		}
+		else if(cmp < 0)
+			hi = mid;
+		else
+			lo = mid + 1;
+	}
+
+	return 0;
+}
+
+/*------------------------------------------------------------------------------- */
+/* Look up a word, or a phrase if more than one word is given, and list the */
+/* paragraphs where it is found. Returns false if nothing was found. */
+bool queryIndex(char *indexFile, int count, char **args)
+{
+	IndexHeader	ih;
+	IndexDoc	doc;
+	IndexPost	*posts[MAX_WORD];
+	IndexPost	key;
+	unsigned	found[MAX_WORD];
+	unsigned	pos, end, i, lastDoc = NO_ENTRY, lastPara = 0;
+	char		ql[512];
+	char		word[MAX_WORD * 3 + 1];
+	char		name[MAX_PATH];
+	int			a, k, words = 0;
+	bool		match = false;
+	FILE		*fp;
+
+	if((fp = fopen(indexFile, "rb")) == NULL)
+		io_error("quill-view: can't open file %s, '%s'\n", indexFile);
+
+	if(! readIndexHeader(fp, &ih, indexFile))
+		exit(1);
+
+	/* split arguments into words the same way as the documents were */
+
+	for(a = 0; a < count; ++a)
+	{
+		if(strlen(args[a]) >= sizeof(ql) / 2)
+			continue;
+
+		end = utf8ToQL(args[a], ql);
+		for(pos = 0; words < MAX_WORD && getWord(ql, &pos, end, word) > 0; ++words)
+		{
+			if((found[words] = readPostings(fp, &ih, word, &posts[words])) == 0)
+			{
+				fclose(fp);
+				return false;
+			}
+		}
+	}
+
+	/* a match is where each word follows the previous in the same paragraph */
+
+	for(i = 0; words > 0 && i < found[0]; ++i)
+	{
+		key = posts[0][i];
+		for(k = 1; k < words; ++k)
+		{
+			++key.word;
+			if(bsearch(&key, posts[k], found[k], IndexPostSize, comparePosts) == NULL)
+				break;
+		}
+
+		if(k < words || (key.doc == lastDoc && key.para == lastPara))
+			continue;
+
+		if(key.doc != lastDoc)
+		{
+			fseek(fp, IndexHeaderSize + (long) key.doc * IndexDocSize, SEEK_SET);
+			if(fread(&doc, 1, IndexDocSize, fp) != IndexDocSize)
+				break;
+			swapIndex(&doc, 1, NULL, 0, NULL, 0);
+			readString(fp, IndexHeaderSize + (long) ih.docCount * IndexDocSize + (long) ih.termCount * IndexTermSize
+					+ (long) ih.postCount * IndexPostSize + doc.name, name, sizeof(name));
+		}
+
+		printf("%s:%d\n", name, key.para);
+		lastDoc = key.doc;
+		lastPara = key.para;
+		match = true;
+	}
+
+	for(k = 0; k < words; ++k)
+		free(posts[k]);
+	fclose(fp);
+
+	return match;
+}
+
+/*------------------------------------------------------------------------------- */
+/* Ask the system to start reading a file that is soon needed, so that the */
+/* reading overlaps with the work on the files before it. */
+void readAhead(char *file)
+{
+#if defined(HAVE_FORK) && defined(POSIX_FADV_WILLNEED)
+	int fd;
+
+	if(packData != NULL)				/* the container is read ahead as a whole */
+		return;
+
+	if((fd = open(file, O_RDONLY)) >= 0)
+	{
+		posix_fadvise(fd, 0, 0, POSIX_FADV_WILLNEED);
+		close(fd);
+	}
+#endif
+}
+
+/*------------------------------------------------------------------------------- */
+/* Run work() for one file of a batch. When it fails with error(), on running */
+/* out of memory say, the file is reported and the batch goes on with the next */
+bool workOne(char *file, bool (*work)(char *file))
+{
+	jmp_buf	here;
+	bool	ok;
+
+	if(setjmp(here) != 0)
+	{
+		if(workIn != NULL)
+			fclose(workIn);
+		if(workOut != NULL)
+		{
+			fclose(workOut);
+			remove(workTarget);			/* rather than half a translation */
+		}
+		workIn = workOut = NULL;
+		traceDoc = NULL;
+		abandonDocument();
+		fprintf(stderr, "quill-view: %s is not translated\n", file);
+		return false;
+	}
+	recovery = &here;
+
+	ok = work(file);
+	recovery = NULL;
+
+	return ok;
+}
+
+/*------------------------------------------------------------------------------- */
+bool workBlock(char **files, int from, int to, bool (*work)(char *file))
+{
+	bool	result = false;
+	int		i;
+
+	for(i = from + 1; i < min(from + READ_AHEAD, to); ++i)
+		readAhead(files[i]);
+
+	for(i = from; i < to; ++i)
+	{
+		if(i + READ_AHEAD < to)
+			readAhead(files[i + READ_AHEAD]);
+		result |= workOne(files[i], work);
+	}
+
+	return result;
+}
+
+/*------------------------------------------------------------------------------- */
+#ifdef HAVE_FORK
+void appendFile(FILE *to, FILE *from)		/* the temporary file from, which is closed */
+{
+	char	buf[4096];
+	size_t	bytes;
+
+	rewind(from);
+	while((bytes = fread(buf, 1, sizeof(buf), from)) > 0)
+		fwrite(buf, 1, bytes, to);
+	fclose(from);
+}
+#endif
+
+/*------------------------------------------------------------------------------- */
+/* Run work() for each file, spread over worker processes. Each worker takes */
+/* a contiguous block of files and writes to a temporary file, which is copied */
+/* to stdout when all are done, so the output is the same as when run serially. */
+/* Returns true if work() returned true for any file. */
+bool runWorkers(char **files, int count, bool (*work)(char *file))
+{
+#ifdef HAVE_FORK
+	bool	result = false;
+	FILE	**out;
+	FILE	**trace;
+	pid_t	*pid;
+	int		n, w, status;
+	double	start;
+	unsigned *memoCounts = NULL;	/* hits and lookups of each worker's paragraph cache */
+
+	n = jobs > 0 ? jobs : (int) sysconf(_SC_NPROCESSORS_ONLN);
+	n = min(n, count);
+
+	if(n > 1)
+	{
+		out = safe_malloc(n * sizeof(FILE *));
+		trace = safe_malloc(n * sizeof(FILE *));
+		pid = safe_malloc(n * sizeof(pid_t));
+#ifdef MAP_ANONYMOUS
+		if(memoLimit > 0 && (memoCounts = mmap(NULL, n * 2 * sizeof(unsigned), PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0)) == MAP_FAILED)
+			memoCounts = NULL;
+#endif
+		fflush(stdout);
+		if(traceFp != NULL)
+		{
+			traceFlush();
+			fflush(traceFp);
+		}
+
+		for(w = 0; w < n; ++w)
+		{
+			if((out[w] = tmpfile()) == NULL || (traceFp != NULL && (trace[w] = tmpfile()) == NULL) || (pid[w] = fork()) < 0)
+				error("quill-view: can't start worker process\n");
+
+			if(pid[w] == 0)
+			{
+				dup2(fileno(out[w]), fileno(stdout));
+				if(traceFp != NULL)
+				{
+					traceFp = trace[w];		/* copied to the trace file when done, as the output */
+					worker = w + 1;
+					traceThread();
+				}
+
+				memoHits = memoLookups = 0;
+				result = workBlock(files, count * w / n, count * (w + 1) / n, work);
+				if(memoCounts != NULL)
+				{
+					memoCounts[w * 2] = memoHits;
+					memoCounts[w * 2 + 1] = memoLookups;
+				}
+				fflush(stdout);
+				if(traceFp != NULL)
+				{
+					traceFlush();
+					fflush(traceFp);
+				}
+				_exit(result ? 0 : 1);
+			}
+		}
+
+		for(w = 0; w < n; ++w)
+		{
+			waitpid(pid[w], &status, 0);
+			if(WIFEXITED(status) && WEXITSTATUS(status) == 0)
+				result = true;
+			else if(WIFSIGNALED(status))
+				fprintf(stderr, "quill-view: worker %d was killed by signal %d, files %s to %s may not be translated\n",
+						w + 1, WTERMSIG(status), files[count * w / n], files[count * (w + 1) / n - 1]);
+
+			start = traceNow();
+			appendFile(stdout, out[w]);
+			traceSpan("write", start);
+
+			if(traceFp != NULL)
+				appendFile(traceFp, trace[w]);
+
+			if(memoCounts != NULL)
+			{
+				memoHits += memoCounts[w * 2];
+				memoLookups += memoCounts[w * 2 + 1];
+			}
+		}
+
+#ifdef MAP_ANONYMOUS
+		if(memoCounts != NULL)
+			munmap(memoCounts, n * 2 * sizeof(unsigned));
+#endif
+
+		free(out);
+		free(trace);
+		free(pid);
+		return result;
+	}
+#endif
+
+	return workBlock(files, 0, count, work);
+}
+
+/*------------------------------------------------------------------------------- */
+void printSnippet(char *text, unsigned from, unsigned to)
+{
+	char	seq[4];
+	int		len;
+
+	for(; from < to; ++from)
+	{
+		if(text[from] == TAB || text[from] == FORM_FEED)
+			putchar(' ');
+		else
+		{
+			len = xlateChar((byte) text[from], seq);
+			fwrite(seq, 1, len, stdout);
+		}
+	}
+}
+
+/*------------------------------------------------------------------------------- */
+/* Search the text area of a document for grepPattern, without any layout. */
+/* Attribute toggles and soft hyphens are removed first, so that words match */
+/* regardless of highlighting. Each matching paragraph is reported once. */
+bool grepFile(char *file)
+{
+	FILE		*fp;
+	char		*text;
+	char		*hit;
+	unsigned	end, len, pos, from, to;
+	unsigned	paraStart, counted;
+	int			para;
+	bool		found = false;
+
+	if((fp = fopen(file, "rb")) == NULL)
+	{
+		fprintf(stderr, "quill-view: can't open file %s, '%s'\n", file, strerror(errno));
+		return false;
+	}
+
+	if(! loadDocument(fp))
+	{
+		fprintf(stderr, "quill-view: %s is not a valid Quill Document\n", file);
+		fclose(fp);
+		return false;
+	}
+	fclose(fp);
+
+	/* copy body paragraphs, skipping highlighting, up to end of text */
+
+	end = header.textLen - HeaderSize;
+	text = arenaAlloc(end + 1);
+
+	for(pos = skipHeaderFooter(), len = 0; pos < end; ++pos)
+	{
+		if(textBuffer[pos] == END_TEXT && (len == 0 || text[len - 1] == END_PARA))
+			break;
+		if(xlate_fold[(byte) textBuffer[pos]] != 1)
+			text[len++] = textBuffer[pos];
+	}
+
+	/* scan for first character of pattern with memchr(), the C library has it */
+	/* well optimized, then compare the rest */
+
+	para = 1;
+	paraStart = counted = 0;
+
+	for(pos = 0; pos + grepLen <= len; )
+	{
+		if((hit = memchr(&text[pos], grepPattern[0], len - pos - grepLen + 1)) == NULL)
+			break;
+
+		pos = (unsigned) (hit - text);
+		if(memcmp(hit, grepPattern, grepLen) != 0)
+		{
+			++pos;
+			continue;
+		}
+
+		while((hit = memchr(&text[counted], END_PARA, pos - counted)) != NULL)	/* find paragraph number */
+		{
+			counted = (unsigned) (hit - text) + 1;
+			paraStart = counted;
+			++para;
+		}
+		counted = pos;
+
+		for(to = pos; to < len && text[to] != END_PARA; ++to)
+			;
+
+		from = pos > paraStart + GREP_CONTEXT ? pos - GREP_CONTEXT : paraStart;
+		printf("%s:%d:", file, para);
+		printSnippet(text, from, min(to, pos + grepLen + GREP_CONTEXT));
+		putchar('\n');
+
+		found = true;
+		pos = to;								/* next paragraph */
+	}
+
+	unloadDocument();
+
+	return found;
+}
+
+/*------------------------------------------------------------------------------- */
+void csvName(char *name)
+{
+	if(strpbrk(name, ",\"\n") == NULL)
+		fputs(name, stdout);
+	else
+	{
+		putchar('"');
+		for(; *name; ++name)
+		{
+			if(*name == '"')
+				putchar('"');
+			putchar(*name);
+		}
+		putchar('"');
+	}
+}
+
+/*------------------------------------------------------------------------------- */
+/* Read part of a file, the reads are unbuffered so only what is asked for */
+/* is read */
+bool readAt(FILE *fp, long pos, void *dst, int len)
+{
+	return fseek(fp, pos, SEEK_SET) == 0 && fread(dst, 1, len, fp) == (size_t) len;
+}
+
+/*------------------------------------------------------------------------------- */
+/* A line of --info, as CSV or, with -j, JSON Lines */
+void infoRow(char *file, bool valid, unsigned size, unsigned textLen, int paraUsed, int pageLen, int wordCount, int headerF, int footerF, int tabSize)
+{
+	int paras = paraUsed > 3 ? paraUsed - 3 : 0;		/* less the first entry, header and footer */
+
+	if(format == Json)
+	{
+		fputs("{\"file\":", stdout);
+		jsonName(stdout, file);
+		if(valid)
+			printf(",\"valid\":true,\"size\":%u,\"textLen\":%u,\"paragraphs\":%d,\"pageLength\":%d,\"wordCount\":%d,\"header\":%d,\"footer\":%d,\"tabSize\":%d}\n",
+				size, textLen - HeaderSize, paras, pageLen, wordCount, headerF, footerF, tabSize);
+		else
+			printf(",\"valid\":false}\n");
+	}
+	else
+	{
+		csvName(file);
+		if(valid)
+			printf(",1,%u,%u,%d,%d,%d,%d,%d,%d\n", size, textLen - HeaderSize, paras, pageLen, wordCount, headerF, footerF, tabSize);
+		else
+			printf(",0,,,,,,,,\n");
+	}
+}
+
+/*------------------------------------------------------------------------------- */
+/* List what a document is from its file header, paragraph table head and */
+/* layout table, as CSV or, with -j, JSON Lines. Nothing else is read, and */
+/* they are checked as by decodeDocument(), so a document listed as valid is */
+/* one that is translated, whatever is in its paragraphs. */
+bool infoFile(char *file)
+{
+	FILE			*fp;
+	Header			h;
+	ParaTableHead	ph;
+	LayoutTable		lt;
+	long			size = 0;
+	bool			valid;
+
+	if((fp = fopen(file, "rb")) == NULL)
+	{
+		fprintf(stderr, "quill-view: can't open file %s, '%s'\n", file, strerror(errno));
+		return false;
+	}
+
+	setvbuf(fp, NULL, _IONBF, 0);
+
+	memset(&h, 0, HeaderSize);
+	memset(&ph, 0, ParaTableHeadSize);
+	memset(&lt, 0, LayoutTableSize);
+
+	valid = fseek(fp, 0, SEEK_END) == 0 && (size = ftell(fp)) > 0 && readAt(fp, 0, &h, HeaderSize);
+	if(valid)
+	{
+#ifndef _QDOS_
+		h.textLen = BElong(h.textLen);
+		h.paraLen = BEword(h.paraLen);
+		h.freeLen = BEword(h.freeLen);
+#endif
+		valid = headerValid(&h, (unsigned) size);
+	}
+	if(valid)
+	{
+		/* the tables of a truncated file read as zeros, as in decodeDocument() */
+
+		readAt(fp, h.textLen, &ph, ParaTableHeadSize);
+		readAt(fp, (long) h.textLen + h.freeLen + h.paraLen, &lt, LayoutTableSize);
+#ifndef _QDOS_
+		ph.size = BEword(ph.size);
+		ph.used = BEword(ph.used);
+		lt.wordCount = BEword(lt.wordCount);
+		lt.tabSize = BEword(lt.tabSize);
+#endif
+		valid = paraTableValid(&ph, (unsigned) size);
+	}
+	fclose(fp);
+
+	infoRow(file, valid, (unsigned) size, h.textLen, ph.used, lt.pageLen, lt.wordCount, lt.headerF, lt.footerF, lt.tabSize);
+
+	return valid;
+}
+
+/*------------------------------------------------------------------------------- */
+/* The files named, with directories replaced by the files in them */
+char **listFiles(char **args, int count, int *listed)
+{
+	char			**files = NULL;
+	char			*file;
+	int				i, n = 0, alloc = 0;
+#ifdef HAVE_FORK
+	struct stat		st;
+	struct dirent	*de;
+	DIR				*dp;
+#endif
+
+	for(i = 0; i < count; ++i)
+	{
+#ifdef HAVE_FORK
+		if(stat(args[i], &st) == 0 && S_ISDIR(st.st_mode) && (dp = opendir(args[i])) != NULL)
+		{
+			while((de = readdir(dp)) != NULL)
+			{
+#ifdef DT_DIR
+				if(de->d_type == DT_DIR)
+					continue;
+#endif
+				if(strcmp(de->d_name, ".") == 0 || strcmp(de->d_name, "..") == 0)
+					continue;
+
+				if(n == alloc)
+				{
+					alloc = max(alloc * 2, 1024);
+					files = safe_realloc(files, alloc * sizeof(char *));
+				}
+
+				file = safe_malloc((int) (strlen(args[i]) + strlen(de->d_name) + 2));
+				sprintf(file, "%s/%s", args[i], de->d_name);
+				files[n++] = file;
+			}
+			closedir(dp);
+			continue;
+		}
+#endif
+		if(n == alloc)
+		{
+			alloc = max(alloc * 2, 1024);
+			files = safe_realloc(files, alloc * sizeof(char *));
+		}
+		files[n++] = args[i];
+	}
+
+	*listed = n;
+	return files;
+}
+
+/*------------------------------------------------------------------------------- */
+char *baseName(char *file)
+{
+	char *name;
+
+	for(name = file + strlen(file); name > file && name[-1] != '/' && name[-1] != '\\'; --name)
+		;
+	return name;
+}
+
+/*------------------------------------------------------------------------------- */
+void targetName(char *file, char *target)
+{
+	sprintf(target, "%.*s/%.*s.%s", MAX_PATH, batchDir, MAX_PATH, baseName(file), format == Text ? "txt" : format == Html ? "html" : "jsonl");
+}
+
+/*------------------------------------------------------------------------------- */
+/* Translate the document decoded to a file of the same name in batchDir, or */
+/* to stdout when batchDir is "-", as for a JSON Lines stream of them all. */
+/* The output is buffered so that it is written in a few large writes. */
+bool writeTarget(char *file)
+{
+	FILE	*out = stdout;
+	char	target[MAX_PATH * 2 + 8] = "(stdout)";
+	bool	ok = true;
+	double	written;
+
+	if(strcmp(batchDir, "-") != 0)
+	{
+		targetName(file, target);
+
+		if((out = fopen(target, "w")) == NULL)
+		{
+			fprintf(stderr, "quill-view: can't open file %s, '%s'\n", target, strerror(errno));
+			return false;
+		}
+
+		setvbuf(out, NULL, _IOFBF, OUTPUT_BUFFER);
+		workOut = out;
+		strcpy(workTarget, target);
+	}
+
+	rendererCount = 0;
+	addRenderer(format, out);
+
+	renderDocument(file);
+
+	written = traceNow();
+	workOut = NULL;
+	if(out == stdout ? fflush(out) != 0 : fclose(out) != 0)
+	{
+		fprintf(stderr, "quill-view: can't write file %s, '%s'\n", target, strerror(errno));
+		ok = false;
+	}
+	traceSpan("write", written);
+
+	if(overBudget != NULL)
+	{
+		if(out != stdout)
+			remove(target);				/* rather than half a translation */
+		ok = false;
+	}
+
+	return ok;
+}
+
+/*------------------------------------------------------------------------------- */
+/* Translate a document of a batch */
+bool convertFile(char *file)
+{
+	FILE	*fp;
+	bool	ok;
+	double	start = traceNow();
+
+	traceDoc = file;
+	traceSize = 0;
+
+	if((fp = fopen(file, "rb")) == NULL)
+	{
+		fprintf(stderr, "quill-view: can't open file %s, '%s'\n", file, strerror(errno));
+		return false;
+	}
+	workIn = fp;
+
+	if(! (streaming ? openDocument(fp) : loadDocument(fp)))
+	{
+		fprintf(stderr, "quill-view: %s is not a valid Quill Document\n", file);
+		workIn = NULL;
+		fclose(fp);
+		unloadDocument();
+		return false;
+	}
+
+	ok = writeTarget(file);
+	workIn = NULL;
+	fclose(fp);
+
+	traceSpan("convert", start);
+	traceDoc = NULL;
+
+	unloadDocument();
+
+	return ok;
+}
+
+/*------------------------------------------------------------------------------- */
+int comparePack(const void *a, const void *b)		/* sorts files on name, without directory */
+{
+	return strcmp(baseName(*(char **) a), baseName(*(char **) b));
+}
+
+/*------------------------------------------------------------------------------- */
+void swapPack(PackHeader *ph, PackDoc *docs, unsigned docCount)
+{
+#ifndef _QDOS_
+	unsigned i;
+
+	if(ph != NULL)
+	{
+		ph->docCount = BElong(ph->docCount);
+		ph->stringLen = BElong(ph->stringLen);
+	}
+	for(i = 0; i < docCount; ++i)
+	{
+		docs[i].name = BElong(docs[i].name);
+		docs[i].offset = BElong(docs[i].offset);
+		docs[i].size = BElong(docs[i].size);
+		docs[i].hash = BElong(docs[i].hash);
+		docs[i].textLen = BElong(docs[i].textLen);
+		docs[i].paraUsed = BEword(docs[i].paraUsed);
+		docs[i].wordCount = BEword(docs[i].wordCount);
+		docs[i].tabSize = BEword(docs[i].tabSize);
+	}
+#endif
+}
+
+/*------------------------------------------------------------------------------- */
+/* Pack documents into a container, for batches of many small documents to */
+/* be read without opening each of them, see --packed. The directory is */
+/* written last, when the documents have been decoded and placed. */
+bool packDocuments(char *packFile, int count, char **args)
+{
+	PackHeader	ph;
+	PackDoc		*docs, *d;
+	char		**files;
+	char		*pool;
+	char		*data;
+	FILE		*fp, *in;
+	unsigned	stringLen = 0, pos, size;
+	bool		ok = true;
+	int			n, i;
+
+	files = listFiles(args, count, &n);
+	qsort(files, n, sizeof(char *), comparePack);
+
+	for(i = 0; i < n; ++i)
+	{
+		if(i > 0 && strcmp(baseName(files[i - 1]), baseName(files[i])) == 0)
+		{
+			fprintf(stderr, "quill-view: %s and %s have the same name\n", files[i - 1], files[i]);
+			return false;
+		}
+		stringLen += (unsigned) strlen(baseName(files[i])) + 1;
+	}
+
+	docs = safe_malloc(max(n, 1) * PackDocSize);
+	pool = safe_malloc(max(stringLen, 1));
+	memset(docs, 0, n * PackDocSize);
+
+	if((fp = fopen(packFile, "wb")) == NULL)
+		io_error("quill-view: can't open file %s, '%s'\n", packFile);
+
+	pos = (PackHeaderSize + n * PackDocSize + stringLen + PACK_ALIGN - 1) & ~(PACK_ALIGN - 1);
+	stringLen = 0;
+
+	for(i = 0, d = docs; i < n; ++i, ++d)
+	{
+		d->name = stringLen;
+		strcpy(&pool[stringLen], baseName(files[i]));
+		stringLen += (unsigned) strlen(baseName(files[i])) + 1;
+
+		if((in = fopen(files[i], "rb")) == NULL)
+		{
+			fprintf(stderr, "quill-view: can't open file %s, '%s'\n", files[i], strerror(errno));
+			ok = false;
+			continue;
 		}
+		data = readFile(in, &size);
+		fclose(in);
+
+		if(pos + size < pos)
+		{
+			fprintf(stderr, "quill-view: %s is too big\n", packFile);
+			exit(1);
+		}
+
+		d->offset = pos;
+		d->size = size;
+		d->hash = hashBytes(data, size);
+		d->valid = setDocument(data, size);
+		if(d->valid)
+		{
+			d->textLen = header.textLen;
+			d->paraUsed = parTableHead.used;
+			d->wordCount = layoutTable.wordCount;
+			d->tabSize = layoutTable.tabSize;
+			d->pageLen = layoutTable.pageLen;
+			d->headerF = layoutTable.headerF;
+			d->footerF = layoutTable.footerF;
+		}
+		else
+			fprintf(stderr, "quill-view: %s is not a valid Quill Document\n", files[i]);
+
+		if(fseek(fp, pos, SEEK_SET) != 0 || fwrite(data, 1, size, fp) != size)
+			io_error("quill-view: can't write file %s, '%s'\n", packFile);
+		pos = (pos + size + PACK_ALIGN - 1) & ~(PACK_ALIGN - 1);
+
+		unloadDocument();
+	}
+
+	memset(&ph, 0, PackHeaderSize);
+	memcpy(ph.id, "qvpack01", sizeof(ph.id));
+	ph.docCount = n;
+	ph.stringLen = stringLen;
+	swapPack(&ph, docs, n);
+
+	if(fseek(fp, 0, SEEK_SET) != 0
+		|| fwrite(&ph, 1, PackHeaderSize, fp) != PackHeaderSize
+		|| fwrite(docs, PackDocSize, n, fp) != (size_t) n
+		|| fwrite(pool, 1, stringLen, fp) != stringLen
+		|| fclose(fp) != 0)
+		io_error("quill-view: can't write file %s, '%s'\n", packFile);
+
+	free(docs);
+	free(pool);
+
+	return ok;
+}
+
+/*------------------------------------------------------------------------------- */
+/* Map a container into memory, for its documents to be used where they are. */
+/* The workers of a batch share the mapping, so it is read once for them all. */
+void openPack(char *file)
+{
+	PackHeader	ph;
+	PackDoc		*d;
+	bool		valid;
+#ifdef HAVE_FORK
+	struct stat	st;
+	int			fd;
+
+	if((fd = open(file, O_RDONLY)) < 0 || fstat(fd, &st) != 0)
+		io_error("quill-view: can't open file %s, '%s'\n", file);
+
+	packSize = (unsigned) st.st_size;
+	if(packSize > 0 && (packData = mmap(NULL, packSize, PROT_READ, MAP_SHARED, fd, 0)) == MAP_FAILED)
+		io_error("quill-view: can't read file %s, '%s'\n", file);
+	close(fd);
+#ifdef MADV_WILLNEED
+	if(packSize > 0)
+		madvise(packData, packSize, MADV_WILLNEED);
+#endif
+#else
+	FILE		*fp;
+	long		len;
+
+	if((fp = fopen(file, "rb")) == NULL)
+		io_error("quill-view: can't open file %s, '%s'\n", file);
+
+	if(fseek(fp, 0, SEEK_END) != 0 || (len = ftell(fp)) < 0 || fseek(fp, 0, SEEK_SET) != 0)
+		io_error("quill-view: can't read file %s, '%s'\n", file);
+
+	packSize = (unsigned) len;
+	packData = safe_malloc(max(packSize, 1));
+	if(fread(packData, 1, packSize, fp) != packSize)
+		io_error("quill-view: can't read file %s, '%s'\n", file);
+	fclose(fp);
+#endif
+
+	/* the directory, checked that it is all there and refers to what is */
+
+	valid = packSize >= (unsigned) PackHeaderSize && memcmp(packData, "qvpack01", 8) == 0;
+	if(valid)
+	{
+		memcpy(&ph, packData, PackHeaderSize);
+		swapPack(&ph, NULL, 0);
+		valid = ph.docCount <= (packSize - PackHeaderSize) / PackDocSize
+			&& ph.stringLen <= packSize - PackHeaderSize - ph.docCount * PackDocSize;
+	}
+	if(valid)
+	{
+		packCount = ph.docCount;
+		packDocs = safe_malloc(max(packCount, 1) * PackDocSize);
+		memcpy(packDocs, packData + PackHeaderSize, packCount * PackDocSize);
+		swapPack(NULL, packDocs, packCount);
+
+		packStrings = packData + PackHeaderSize + packCount * PackDocSize;
+		valid = ph.stringLen == 0 || packStrings[ph.stringLen - 1] == 0;
+
+		for(d = packDocs; valid && d < &packDocs[packCount]; ++d)
+			valid = d->name < ph.stringLen && d->offset <= packSize && d->size <= packSize - d->offset;
+	}
+	if(! valid)
+	{
+		fprintf(stderr, "quill-view: %s is not a quill-view container\n", file);
+		exit(1);
+	}
+
+	packName = file;
+}
+
+/*------------------------------------------------------------------------------- */
+PackDoc *findPacked(char *name)
+{
+	int lo = 0, hi = (int) packCount - 1, mid, cmp;
+
+	while(lo <= hi)
+	{
+		mid = (lo + hi) / 2;
+		if((cmp = strcmp(name, &packStrings[packDocs[mid].name])) == 0)
+			return &packDocs[mid];
+		if(cmp < 0)
+			hi = mid - 1;
+		else
+			lo = mid + 1;
+	}
+
+	fprintf(stderr, "quill-view: %s is not in %s\n", name, packName);
+	return NULL;
+}
+
+/*------------------------------------------------------------------------------- */
+/* Translate a document of a batch from the container, where it is, so there */
+/* is no system call for it until the translation is written */
+bool convertPacked(char *name)
+{
+	PackDoc	*d;
+	bool	ok;
+	double	start = traceNow();
+
+	if((d = findPacked(name)) == NULL)
+		return false;
+
+	traceDoc = name;
+	traceSize = d->size;
+
+	if(! d->valid || ! setDocument(packData + d->offset, d->size))
+	{
+		fprintf(stderr, "quill-view: %s is not a valid Quill Document\n", name);
+		unloadDocument();
+		return false;
+	}
+	docHash = d->hash;
+	docHashed = true;
+
+	ok = writeTarget(name);
+
+	traceSpan("convert", start);
+	traceDoc = NULL;
+
+	unloadDocument();
+
+	return ok;
+}
+
+/*------------------------------------------------------------------------------- */
+/* --info of the documents in the container, from its directory alone */
+bool infoPacked(char *name)
+{
+	PackDoc *d;
+
+	if((d = findPacked(name)) == NULL)
+		return false;
+
+	infoRow(name, d->valid, d->size, d->textLen, d->paraUsed, d->pageLen, d->wordCount, d->headerF, d->footerF, d->tabSize);
+
+	return d->valid;
+}
+
+/*------------------------------------------------------------------------------- */
+/* The documents named, or all in the container */
+char **listPacked(char **args, int count, int *listed)
+{
+	char		**names;
+	unsigned	i;
+
+	if(count > 0)
+	{
+		*listed = count;
+		return args;
+	}
+
+	names = safe_malloc(max(packCount, 1) * sizeof(char *));
+	for(i = 0; i < packCount; ++i)
+		names[i] = &packStrings[packDocs[i].name];
+
+	*listed = (int) packCount;
+	return names;
+}
+
+/*------------------------------------------------------------------------------- */
+void addPage(unsigned record, int pageNo, byte attrs, bool inPara, int firstPara)
+{
+	Page *pg;
+
+	if(pageCount == pageAlloc)
+	{
+		pageAlloc = max(pageAlloc * 2, 64);
+		pages = safe_realloc(pages, pageAlloc * sizeof(Page));
+	}
+
+	if(pageCount > 0)
+		pages[pageCount - 1].end = record - 3;		/* before the L_PAGE record */
+
+	pg = &pages[pageCount++];
+	pg->record = record;
+	pg->end = layoutRecLen;
+	pg->pageNo = pageNo;
+	pg->attrs = attrs;
+	pg->inPara = inPara;
+	pg->firstPara = inPara ? firstPara - 1 : firstPara;
+}
+
+/*------------------------------------------------------------------------------- */
+byte toggleAttrs(byte attrs, char *text, unsigned from, unsigned to)
+{
+	for(; from < to; ++from)
+		if(text[from] >= BOLD && text[from] <= SUPER_SCRIPT)
+			attrs ^= 1 << (text[from] - BOLD);
+
+	return attrs;
+}
+
+/*------------------------------------------------------------------------------- */
+/* Find where each page starts in the layout records, and what is going on */
+/* there: the highlighting toggled on by the text before it, and whether it */
+/* starts within a paragraph. The records are as replayLayout() reads them. */
+void scanPages()
+{
+	byte		*p = layoutRec;
+	byte		*end = layoutRec + layoutRecLen;
+	byte		attrs = 0;
+	bool		inPara = false;
+	int			paras = 0;
+	unsigned	from, to;
+
+	pageCount = 0;
+	addPage(0, 1, 0, false, 1);
+
+	while(p < end)
+	{
+		switch(*p++)
+		{
+		case L_PARA_START:
+			++paras;
+			inPara = true;
+			break;
+		case L_PARA_END:
+			inPara = false;
+			break;
+		case L_RESET:
+			attrs = 0;
+			break;
+		case L_MARGIN:
+			p += 2;
+			break;
+		case L_LINE:
+			from = getRecord(&p, 4);
+			to = getRecord(&p, 4);
+			p += 8;
+			p += getRecord(&p, 2);
+			attrs = toggleAttrs(attrs, textBuffer, from, to);
+			break;
+		case L_STRING:
+			to = (unsigned) strlen((char *) p);
+			attrs = toggleAttrs(attrs, (char *) p, 0, to);
+			p += to + 1;
+			break;
+		case L_PAGE:
+			from = getRecord(&p, 2);
+			addPage((unsigned) (p - layoutRec), from, attrs, inPara, paras + 1);
+			break;
+		}
+	}
+}
+
+/*------------------------------------------------------------------------------- */
+/* Render a page on its own, to file, one of pageNames */
+bool renderPage(char *file)
+{
+	Page		*pg;
+	FILE		*fp;
+	Renderer	*r = renderers;
+	bool		ok;
+
+	for(pg = pages; pageNames[pg - pages] != file; ++pg)
+		;
+
+	if((fp = fopen(file, "w")) == NULL)
+	{
+		fprintf(stderr, "quill-view: can't open file %s, '%s'\n", file, strerror(errno));
+		return false;
+	}
+
+	setvbuf(fp, NULL, _IOFBF, OUTPUT_BUFFER);
+	rendererCount = 0;
+	addRenderer(format, fp);
+	renderHead();
+
+	r->bold = (pg->attrs & 1) != 0;
+	r->underline = (pg->attrs & 2) != 0;
+	r->sub = (pg->attrs & 4) != 0;
+	r->super = (pg->attrs & 8) != 0;
+
+	if(pg->inPara)
+		fputs(r->paraStart, fp);
+
+	replayLayout(&layoutRec[pg->record], pg->end - pg->record, 0, true);
+
+	if(pg + 1 < &pages[pageCount] && pg[1].inPara)
+		fputs(r->paraEnd, fp);
+	if(format == Html)
+		fputs(HTML_TAIL, fp);
+
+	ok = fclose(fp) == 0;
+	if(! ok)
+		fprintf(stderr, "quill-view: can't write file %s, '%s'\n", file, strerror(errno));
+
+	return ok;
+}
+
+/*------------------------------------------------------------------------------- */
+/* List the pages, with the paragraphs on them, in an index file next to them */
+void writePageIndex(char *srcfile)
+{
+	FILE	*fp;
+	char	name[MAX_PATH + 16];
+	char	*page;
+	int		i, last;
+
+	sprintf(name, "%.*s/index.%s", MAX_PATH, pageDir, format == Text ? "txt" : "html");
+	if((fp = fopen(name, "w")) == NULL)
+		io_error("quill-view: can't open file %s, '%s'\n", name);
+
+	if(format == Html)
+		fprintf(fp, "%s<p>File: %.*s</p>\n<p>\n", HTML_HEAD, MAX_PATH, srcfile);
+	else
+		fprintf(fp, "File: %s\n\n", srcfile);
+
+	for(i = 0; i < pageCount; ++i)
+	{
+		page = pageNames[i] + strlen(pageDir) + 1;
+		last = i + 1 < pageCount ? pages[i + 1].firstPara - 1 : paraCount - 2;
+		if(i + 1 < pageCount && pages[i + 1].inPara)
+			++last;
+
+		if(format == Html)
+			fprintf(fp, "<a href=\"%s\">Page %d</a>&nbsp;paragraphs %d-%d<br>\n", page, pages[i].pageNo, pages[i].firstPara, last);
 		else
-		{
-			lMarg = indentLine ?  parTab->indentMarg : parTab->leftMarg;
-			rMarg = parTab->rightMarg;
-		}
+			fprintf(fp, "%s\tpage %d\tparagraphs %d-%d\n", page, pages[i].pageNo, pages[i].firstPara, last);
+	}
 
-		indentLine = false;			/* only valid for first line */
-		col = lMarg;
-		newPageFlag = false;
+	if(format == Html)
+		fprintf(fp, "</p>\n%s", HTML_TAIL);
 
-		/* while within max line width, collect words and build line */
-		/* remember last space so we can backout to fit last word within rMarg */
+	if(fclose(fp) != 0)
+		io_error("quill-view: can't write file %s, '%s'\n", name);
+}
 
-		do {
-			if(textBuffer[offset] == FORM_FEED)
-				newPageFlag = true;
-			if(isPrintable(textBuffer[offset]))
-				++col;					/* advance column  */
-			if(textBuffer[offset] == SPACE)
-			{
-				lastSpace = offset;			/* remember last space in case we need to break line */
-				lastSpacePtr = lineBufPtr;
-				lastCol = col;
-			}
+/*------------------------------------------------------------------------------- */
+/* Translate the document to a file for each page in pageDir. The document */
+/* is laid out first, to find the pages, which are then rendered in parallel, */
+/* each on its own. */
+void splitPages(char *srcfile)
+{
+	int i;
 
-			if(textBuffer[offset] == TAB)			/* expand tabs */
-			{
-				int nextTab = getNextTab(parTab->tabTable, col + 1);
+	if(! loadDocument(stdin))
+		error("Not a valid Quill Document\n");
 
-				if(nextTab < 0) {
-					++offset;
-					break;				/* if no more tabs, finnish line here */
-				}
+	if(strlen(pageDir) > MAX_PATH)
+		error("quill-view: page directory name too long\n");
 
-				while(col < nextTab)
-				{
-					*lineBufPtr++ = SPACE;
-					++col;
-				}
-			}
-			else
-				*lineBufPtr++ = textBuffer[offset];
-			++offset;
-		} while(textBuffer[offset] != END_PARA && col < rMarg);
+	rendererCount = 0;									/* only recorded */
+	recording = true;
+	layoutRecLen = 0;
+	layoutDocument(NULL);
+	recording = false;
+
+	scanPages();
+
+	pageNames = safe_malloc(pageCount * sizeof(char *));
+	for(i = 0; i < pageCount; ++i)
+	{
+		pageNames[i] = safe_malloc(MAX_PATH + 32);
+		sprintf(pageNames[i], "%s/page-%04d.%s", pageDir, pages[i].pageNo, format == Text ? "txt" : "html");
+	}
+
+	runWorkers(pageNames, pageCount, renderPage);
+	writePageIndex(srcfile);
+}
+
+/*------------------------------------------------------------------------------- */
+/* A document read for --diff, its data is kept between the passes */
+bool diffLoad(DiffDoc *d)
+{
+	FILE	*fp;
+	long	len;
+
+	if((fp = fopen(d->file, "rb")) == NULL)
+	{
+		fprintf(stderr, "quill-view: can't open file %s, '%s'\n", d->file, strerror(errno));
+		return false;
+	}
+
+	if(fseek(fp, 0, SEEK_END) != 0 || (len = ftell(fp)) < 0 || fseek(fp, 0, SEEK_SET) != 0)
+		len = 0;
+	d->data = safe_malloc((int) len + 1);
+	d->size = (unsigned) fread(d->data, 1, len, fp);
+	fclose(fp);
+
+	if(! setDocument(d->data, d->size))
+	{
+		fprintf(stderr, "quill-view: %s is not a valid Quill Document\n", d->file);
+		unloadDocument();
+		return false;
+	}
+
+	/* the paragraphs, hashed with their margins, as for the layout cache */
+
+	rendererCount = 0;
+	scanParagraphs(startLayout());
+
+	d->count = (int) layoutParaCount;
+	d->hash = safe_malloc(d->count * sizeof(unsigned) + 1);
+	d->match = safe_malloc(d->count * sizeof(int) + 1);
+	d->show = safe_malloc(d->count * sizeof(bool) + 1);
+	d->start = safe_malloc((d->count + 1) * sizeof(long));
+
+	for(d->count = 0; d->count < (int) layoutParaCount; ++d->count)
+	{
+		d->hash[d->count] = layoutPara[d->count].hash;
+		d->match[d->count] = -1;
+		d->show[d->count] = false;
+	}
+
+	unloadDocument();
+
+	return true;
+}
+
+/*------------------------------------------------------------------------------- */
+DiffSym *diffSymbol(DiffSym *syms, unsigned size, unsigned hash)
+{
+	unsigned h;
+
+	for(h = (hash * 2654435761u) & (size - 1); syms[h].countA + syms[h].countB > 0; h = (h + 1) & (size - 1))
+		if(syms[h].hash == hash)
+			break;
+
+	syms[h].hash = hash;
+
+	return &syms[h];
+}
+
+/*------------------------------------------------------------------------------- */
+void diffMatch(DiffDoc *a, DiffDoc *b, int i, int j)
+{
+	a->match[i] = j;
+	b->match[j] = i;
+}
+
+/*------------------------------------------------------------------------------- */
+/* Match the paragraphs of a and b, in linear time. After the paragraphs the */
+/* same at start and at end, paragraphs that are in each document once are */
+/* matched, and the matches are extended to the paragraphs next to them */
+/* (P. Heckel, "A technique for isolating differences between files", 1978). */
+/* Matches out of order, paragraphs moved, are then dropped, so what is left */
+/* is a sequence of deletions and insertions. */
+void diffAlign(DiffDoc *a, DiffDoc *b)
+{
+	DiffSym		*syms, *sym;
+	unsigned	size;
+	int			head, endA, endB, i, j, last;
+
+	for(head = 0; head < a->count && head < b->count && a->hash[head] == b->hash[head]; ++head)
+		diffMatch(a, b, head, head);
+
+	for(endA = a->count, endB = b->count; endA > head && endB > head && a->hash[endA - 1] == b->hash[endB - 1]; )
+		diffMatch(a, b, --endA, --endB);
 
-		*lineBufPtr = 0;
+	for(size = 16; size < (unsigned) (endA - head + endB - head) * 2; size *= 2)
+		;
+	syms = safe_malloc(size * sizeof(DiffSym));
+	memset(syms, 0, size * sizeof(DiffSym));
+
+	for(i = head; i < endA; ++i)
+	{
+		sym = diffSymbol(syms, size, a->hash[i]);
+		++sym->countA;
+		sym->posA = i;
+	}
+
+	for(j = head; j < endB; ++j)
+	{
+		sym = diffSymbol(syms, size, b->hash[j]);
+		++sym->countB;
+		sym->posB = j;
+	}
+
+	for(j = head; j < endB; ++j)
+	{
+		sym = diffSymbol(syms, size, b->hash[j]);
+		if(sym->countA == 1 && sym->countB == 1)
+			diffMatch(a, b, sym->posA, j);
+	}
+	free(syms);
+
+	for(j = head; j < endB - 1; ++j)			/* forward from each match... */
+		if((i = b->match[j]) >= 0 && i + 1 < endA && b->match[j + 1] < 0 && a->match[i + 1] < 0 && a->hash[i + 1] == b->hash[j + 1])
+			diffMatch(a, b, i + 1, j + 1);
+
+	for(j = endB - 1; j > head; --j)			/* ...and back */
+		if((i = b->match[j]) > head && b->match[j - 1] < 0 && a->match[i - 1] < 0 && a->hash[i - 1] == b->hash[j - 1])
+			diffMatch(a, b, i - 1, j - 1);
 
-		if(col >= rMarg && lastSpacePtr != NULL)	/* break line */
+	for(j = head, last = head - 1; j < endB; ++j)
+	{
+		if((i = b->match[j]) < 0)
+			continue;
+		if(i > last)
+			last = i;
+		else
 		{
-			*lastSpacePtr = 0;						/* back up to last space */
-			offset = lastSpace;						/* advance on after last space, so we don't loop forever */
-			col = lastCol;
-			while(textBuffer[offset] == SPACE)		/* skip initial spaces on line */
-				++offset;
+			a->match[i] = -1;					/* moved */
+			b->match[j] = -1;
 		}
+	}
+}
 
-		renderMargin(lMarg);
-		renderLine(lineBuf);
+/*------------------------------------------------------------------------------- */
+/* Lay out the paragraphs of d that are shown, to a temporary file that is */
+/* then read into d->text. Page breaks are left out. */
+void diffRender(DiffDoc *d)
+{
+	FILE	*fp;
+	long	len;
+	int		k;
 
-		if(newPageFlag)
-			newPage();
+	if((fp = tmpfile()) == NULL)
+		io_error("quill-view: can't create temporary file%s, '%s'\n", "");
+
+	setDocument(d->data, d->size);
+
+	rendererCount = 0;
+	addRenderer(Text, fp);
+	scanParagraphs(startLayout());
+	maxLines = 0;
+	unpaged = true;
+
+	for(k = 0; k < d->count; ++k)
+	{
+		d->start[k] = ftell(fp);
+		if(d->show[k])
+		{
+			offset = layoutPara[k].offset;
+			printPara(layoutParaTab[k]);
+		}
 	}
+	d->start[k] = len = ftell(fp);
+
+	unpaged = false;
+	unloadDocument();
+
+	d->text = safe_malloc((int) len + 1);
+	rewind(fp);
+	if(fread(d->text, 1, len, fp) != (size_t) len)
+		io_error("quill-view: can't read temporary file%s, '%s'\n", "");
+	fclose(fp);
 }
 
 /*------------------------------------------------------------------------------- */
-void printRightPara(ParaTable *parTab)
+/* Paragraph k of d, with each line marked by mark */
+void diffPrint(DiffDoc *d, int k, char *mark)
 {
-	char	lineBuf[512];
-	char	resultBuf[512];
-	char	*resultPtr;
-	char	*lineBufPtr;
-	bool	indentLine;
-	int		col;
-	int		lastSpace;
-	char	*lastSpacePtr;
-	int	lastCol;
-	int	lMarg;
-	int	rMarg;
-	int	i, j, pads, spaces, padSpace, lastTab;
-	bool	newPageFlag;
-	bool	tabWrapFlag;
-
-	indentLine = true;								/* first line is indent line */
-	while(textBuffer[offset] != 0)					/* until end of paragraph, for each line */
-	{
-		newPageFlag = false;
-		tabWrapFlag = false;
-		col = 0;
-		lastCol = 0;
-		lineBufPtr = lineBuf;
-		lastSpace = 0;
-		lastSpacePtr = NULL;
+	char	*p = d->text + d->start[k];
+	char	*end = d->text + d->start[k + 1];
+	int		step = encoding->wide ? 2 : 1;
+	char	*line;
 
-		if(maxLines && lineNo >= maxLines)
-			newPage();
+	for(line = p; p < end; p += step)
+	{
+		if(*p == '\n')
+		{
+			renderAscii(mark, 1);
+			fwrite(line, 1, p + step - line, stdout);
+			line = p + step;
+		}
+	}
+}
 
-		/* calculate effective margins */
+/*------------------------------------------------------------------------------- */
+/* Compare two documents paragraph by paragraph, the changed paragraphs are */
+/* laid out as text with DIFF_CONTEXT paragraphs around them, in the form of */
+/* a unified diff. Paragraphs are numbered from 1, after header and footer. */
+/* Returns 0 if the same, 1 if different and 2 if a document can't be read. */
+int diffDocuments(char *fileA, char *fileB)
+{
+	DiffDoc		a, b;
+	DiffOp		*ops;
+	char		tmp[MAX_PATH * 2 + 64];
+	int			i, j, t, n, near, from, countA, countB;
+	bool		changed = false;
 
-		lMarg = indentLine ?  parTab->indentMarg : parTab->leftMarg;
-		rMarg = parTab->rightMarg;
+	memset(&a, 0, sizeof(a));
+	memset(&b, 0, sizeof(b));
+	a.file = fileA;
+	b.file = fileB;
 
-		indentLine = false;							/* only valid for first line */
-		col = lMarg;
+	if(! diffLoad(&a) || ! diffLoad(&b))
+		return 2;
 
-		/* while within right margin, collect words and build line */
-		/* remember last space so we can back out to fit last word within rMarg */
+	diffAlign(&a, &b);
 
-		do {
-			/*if(textBuffer[offset] == FORM_FEED) */
-			/*	newPageFlag = true; */
+	/* the edits, paragraphs of a deleted before those of b inserted */
 
-			if(textBuffer[offset] == SPACE || textBuffer[offset] == TAB || textBuffer[offset] == SOFT_HYPEN)
-			{
-				lastSpace = offset;					/* remember last space in case we need to break line */
-				lastSpacePtr = lineBufPtr;
-				lastCol = col;
-			}
+	ops = safe_malloc((a.count + b.count + 1) * sizeof(DiffOp));
 
-			if(textBuffer[offset] == TAB)			/* expand tabs */
-			{
-				int nextTab = getNextTab(parTab->tabTable, col + 1);
+	for(i = j = n = 0; i < a.count || j < b.count; ++n)
+	{
+		ops[n].i = i;
+		ops[n].j = j;
 
-				if(nextTab < 0) {
-					tabWrapFlag = true;				/* wraps to next line */
-					++offset;						/* tab consumed */
-					break;							/* no more tabs, wrap line here */
-				}
+		if(i < a.count && a.match[i] < 0)
+			ops[n].op = '-', ++i;
+		else if(j < b.count && b.match[j] < 0)
+			ops[n].op = '+', ++j;
+		else
+			ops[n].op = ' ', ++i, ++j;
 
-				while(col < nextTab && col < rMarg)
-				{
-					*lineBufPtr++ = TAB;			/* we write tabs to local buffer, to distinuish from normal space later on */
-					++col;
-				}
-			}
-			else
-			{
-				*lineBufPtr++ = textBuffer[offset];	/* copy to local buffer */
+		ops[n].show = ops[n].op != ' ';
+		changed |= ops[n].show;
+	}
 
-				if(isPrintable(textBuffer[offset]))
-					++col;							/* advance column  */
-			}
-			++offset;
-		} while(textBuffer[offset] != END_PARA && col < rMarg);
+	/* ...and the paragraphs near them */
+
+	for(t = 0, near = DIFF_CONTEXT + 1; t < n; ++t)
+	{
+		near = ops[t].show ? 0 : near + 1;
+		ops[t].show |= near <= DIFF_CONTEXT;
+	}
+	for(t = n - 1, near = DIFF_CONTEXT + 1; t >= 0; --t)
+	{
+		near = ops[t].op != ' ' ? 0 : near + 1;
+		ops[t].show |= near <= DIFF_CONTEXT;
+	}
+
+	for(t = 0; t < n; ++t)
+	{
+		if(ops[t].show && ops[t].op == '-')
+			a.show[ops[t].i] = true;
+		else if(ops[t].show)
+			b.show[ops[t].j] = true;
+	}
+
+	diffRender(&a);
+	diffRender(&b);
+
+	rendererCount = 0;
+	addRenderer(Text, stdout);
+	rd = renderers;
+
+	if(changed)
+	{
+		sprintf(tmp, "--- %.*s\n+++ %.*s\n", MAX_PATH, fileA, MAX_PATH, fileB);
+		renderAscii(tmp, (int) strlen(tmp));
+	}
 
-		*lineBufPtr = 0;
+	/* a hunk for each run of paragraphs shown */
 
-		if(textBuffer[offset] == END_PARA || tabWrapFlag)	/* if end of para reached, or line ended with tab */
+	for(t = 0; t < n; )
+	{
+		if(! ops[t].show)
 		{
-			strcpy(resultBuf, lineBuf);				/* ...don't right justify */
+			++t;
+			continue;
 		}
-		else										/* ...else, right justify */
+
+		for(from = t, countA = countB = 0; t < n && ops[t].show; ++t)
 		{
-			if(col >= rMarg && lastSpacePtr != NULL)	/* break line */
-			{
-				*lastSpacePtr = 0;					/* strip of trailing spaces			 */
-				--lastSpacePtr;
-				while(*lastSpacePtr == SPACE && lastSpacePtr > lineBuf)
-				{
-					*lastSpacePtr = 0;
-					--lastSpacePtr;
-					--lastCol;
-				}
+			countA += ops[t].op != '+';
+			countB += ops[t].op != '-';
+		}
 
-				offset = lastSpace;
-				col = lastCol;
-				while(textBuffer[offset] == SPACE)	/*	 || textBuffer[offset] == FORM_FEED */
-					++offset;						/* skip initial spaces on line */
-			}
+		sprintf(tmp, "@@ -%d,%d +%d,%d @@\n", ops[from].i + (countA > 0), countA, ops[from].j + (countB > 0), countB);
+		renderAscii(tmp, (int) strlen(tmp));
 
-			/* right justify line */
+		for(; from < t; ++from)
+		{
+			if(ops[from].op == '-')
+				diffPrint(&a, ops[from].i, "-");
+			else
+				diffPrint(&b, ops[from].j, ops[from].op == '+' ? "+" : " ");
+		}
+	}
 
-			pads = rMarg - col;
+	free(ops);
 
-			/* count no of spaces in line, and figure how many padding spaces to add per space. */
-			/* if we find a tab, reset counter (as we cant pad before a tab, only after) and also */
-			/* remember where the last tab was found, so we can start from there */
+	return changed ? 1 : 0;
+}
 
-			spaces = 0;
-			lastTab = 0;
-			for(i = 0; lineBuf[i] != 0; ++i)
-			{
-				if(lineBuf[i] == TAB)
-				{
-					spaces = 0;
-					lastTab = i;
-				}
-				if(lineBuf[i] == SPACE)
-					++spaces;
-			}
+/*------------------------------------------------------------------------------- */
+#ifdef HAVE_FORK
+volatile sig_atomic_t	stopping;		/* SIGINT or SIGTERM came, see stopOnSignal() */
 
-			if(pads <= spaces)
-				padSpace = 1;
-			else if(spaces > 0)
-				padSpace = pads / spaces;
-			else
-				padSpace = 1;
+void stopHandler(int sig)
+{
+	stopping = sig;
+}
 
-			if(lastTab > 0)
-			{
-				memcpy(resultBuf, lineBuf, lastTab);		/* copy up to last tab */
-				resultPtr = &resultBuf[lastTab];			/* and set start pinter to the last tab */
-			} else
-				resultPtr = resultBuf;
+/*------------------------------------------------------------------------------- */
+/* --http and --watch run until stopped. They end at the next poll() rather */
+/* than being killed, so that the trace is closed, see finish(). With */
+/* SA_RESTART the work in between isn't interrupted, poll() never restarts */
+void stopOnSignal()
+{
+	struct sigaction sa;
+
+	memset(&sa, 0, sizeof(sa));
+	sa.sa_handler = stopHandler;
+	sa.sa_flags = SA_RESTART;
+	sigemptyset(&sa.sa_mask);
+	sigaction(SIGINT, &sa, NULL);
+	sigaction(SIGTERM, &sa, NULL);
+}
+#endif
 
-			/* pad with spaces to make line fit exaclty between margins */
+/*------------------------------------------------------------------------------- */
+#ifdef __linux__
+/* A Quill document that is newer than its translation */
+bool outOfDate(char *file)
+{
+	FILE		*fp;
+	Header		h;
+	char		target[MAX_PATH * 2 + 8];
+	unsigned	size, srcTime, dstTime;
+	bool		quill;
 
-			for(i = lastTab; lineBuf[i]; ++i)
-			{
-				if(lineBuf[i] == SPACE)
-				{
-					*resultPtr++ = SPACE;
-					if(--spaces == 0)						/* if last space, add all remaining pads */
-						while(pads--)
-							*resultPtr++ = ' ';
-					else									/* else add 'padSpace' pads */
-						for(j = 0; j < padSpace; ++j)
-							if(pads > 0)
-							{
-								*resultPtr++ = ' ';
-								--pads;
-							}
-				}
-				else
-					*resultPtr++ = lineBuf[i];
-			}
+	if((fp = fopen(file, "rb")) == NULL)
+		return false;
 
-			*resultPtr = 0;
+	quill = fread(&h, 1, HeaderSize, fp) == HeaderSize && memcmp(h.id, "vrm1qdf0", sizeof(h.id)) == 0;
+	fclose(fp);
+
+	targetName(file, target);
+
+	return quill && fileStat(file, &size, &srcTime) && (! fileStat(target, &size, &dstTime) || srcTime >= dstTime);
+}
+
+/*------------------------------------------------------------------------------- */
+/* Add a document to those pending, once however often it is written */
+void addPending(char *dir, char *name)
+{
+	char		file[MAX_PATH * 2 + 2];
+	unsigned	i, mask;
+
+	sprintf(file, "%.*s/%.*s", MAX_PATH, dir, MAX_PATH, name);
+
+	if((unsigned) pendingCount * 2 >= pendingHashSize)		/* keep hash table at most half full */
+	{
+		pendingHashSize = pendingHashSize ? pendingHashSize * 2 : 256;
+		pendingHash = safe_realloc(pendingHash, pendingHashSize * sizeof(unsigned));
+		memset(pendingHash, 0, pendingHashSize * sizeof(unsigned));
+
+		for(mask = pendingHashSize - 1, i = 0; i < (unsigned) pendingCount; ++i)
+		{
+			unsigned slot = hashString(pending[i]) & mask;
+
+			while(pendingHash[slot] != 0)
+				slot = (slot + 1) & mask;
+			pendingHash[slot] = i + 1;
 		}
+	}
+
+	mask = pendingHashSize - 1;
+	for(i = hashString(file) & mask; pendingHash[i] != 0; i = (i + 1) & mask)
+		if(strcmp(pending[pendingHash[i] - 1], file) == 0)
+			return;
+
+	pendingHash[i] = pendingCount + 1;
+
+	if(pendingCount == pendingAlloc)
+	{
+		pendingAlloc = max(pendingAlloc * 2, 64);
+		pending = safe_realloc(pending, pendingAlloc * sizeof(char *));
+	}
+
+	pending[pendingCount] = safe_malloc((int) strlen(file) + 1);
+	strcpy(pending[pendingCount++], file);
+}
+
+/*------------------------------------------------------------------------------- */
+void translatePending()
+{
+	int i, n;
+
+	for(i = n = 0; i < pendingCount; ++i)
+	{
+		if(outOfDate(pending[i]))
+			pending[n++] = pending[i];
+		else
+			free(pending[i]);
+	}
+
+	runWorkers(pending, n, convertFile);
+	if(traceFp != NULL)
+	{
+		traceFlush();					/* the spans name the documents freed here */
+		fflush(traceFp);
+	}
 
-		renderMargin(lMarg);
-		renderLine(resultBuf);
+	for(i = 0; i < n; ++i)
+		free(pending[i]);
+	pendingCount = 0;
+	if(pendingHash != NULL)
+		memset(pendingHash, 0, pendingHashSize * sizeof(unsigned));
+}
 
-		for(i = 0; resultBuf[i]; ++i)
-			if(resultBuf[i] == FORM_FEED)
+/*------------------------------------------------------------------------------- */
+/* Translate documents in dir into batchDir whenever they are written. Names */
+/* are collected until there are no more changes for DEBOUNCE ms, so that a */
+/* document written in bursts is translated once. Documents changed while not */
+/* watching are translated at start. */
+void watchDirectory(char *dir)
+{
+	struct inotify_event	*ev;
+	struct pollfd			pfd;
+	struct dirent			*de;
+	DIR						*dp;
+	char					buf[4096] __attribute__ ((aligned(__alignof__(struct inotify_event))));
+	char					*p;
+	ssize_t					bytes;
+
+	if((pfd.fd = inotify_init()) < 0 || inotify_add_watch(pfd.fd, dir, IN_CLOSE_WRITE | IN_MOVED_TO) < 0)
+		io_error("quill-view: can't watch directory %s, '%s'\n", dir);
+	pfd.events = POLLIN;
+
+	if((dp = opendir(dir)) == NULL)
+		io_error("quill-view: can't open directory %s, '%s'\n", dir);
+	while((de = readdir(dp)) != NULL)
+		addPending(dir, de->d_name);
+	closedir(dp);
+
+	translatePending();
+
+	stopOnSignal();
+	while(! stopping)
+	{
+		switch(poll(&pfd, 1, pendingCount > 0 ? DEBOUNCE : -1))
+		{
+		case 0:
+			translatePending();				/* quiet for a while */
+			break;
+		case 1:
+			bytes = read(pfd.fd, buf, sizeof(buf));
+			for(p = buf; p < buf + bytes; p += sizeof(struct inotify_event) + ev->len)
 			{
-				newPage();
-				break;
+				ev = (struct inotify_event *) p;
+				if(ev->len > 0)
+					addPending(dir, ev->name);
 			}
+			break;
+		}
+	}
+}
+#endif
+
+/*------------------------------------------------------------------------------- */
+#ifdef HAVE_FORK
+void httpUnlink(HttpEntry *e)			/* from the least recently used list */
+{
+	if(e->prev != NULL)
+		e->prev->next = e->next;
+	else
+		httpNewest = e->next;
+
+	if(e->next != NULL)
+		e->next->prev = e->prev;
+	else
+		httpOldest = e->prev;
+}
+
+/*------------------------------------------------------------------------------- */
+void httpLink(HttpEntry *e)				/* ...as the most recently used */
+{
+	e->prev = NULL;
+	e->next = httpNewest;
+
+	if(httpNewest != NULL)
+		httpNewest->prev = e;
+	else
+		httpOldest = e;
+
+	httpNewest = e;
+}
+
+/*------------------------------------------------------------------------------- */
+HttpEntry **httpSlotOf(char *path, Format fmt)
+{
+	return &httpSlot[(hashString(path) + fmt) & (HTTP_SLOTS - 1)];
+}
+
+/*------------------------------------------------------------------------------- */
+void httpFree(HttpEntry *e)
+{
+	free(e->path);
+	free(e->body);
+	free(e->gzip);
+	free(e);
+}
+
+/*------------------------------------------------------------------------------- */
+void httpDrop(HttpEntry *e)
+{
+	HttpEntry **p;
+
+	for(p = httpSlotOf(e->path, e->format); *p != e; p = &(*p)->chain)
+		;
+	*p = e->chain;
+
+	httpUnlink(e);
+	httpCacheLen -= e->bodyLen + e->gzipLen;
+	httpFree(e);
+}
+
+/*------------------------------------------------------------------------------- */
+HttpEntry *httpFind(char *path, Format fmt)
+{
+	HttpEntry *e;
+
+	for(e = *httpSlotOf(path, fmt); e != NULL; e = e->chain)
+		if(e->format == fmt && strcmp(e->path, path) == 0)
+			return e;
+
+	return NULL;
+}
+
+/*------------------------------------------------------------------------------- */
+/* Keep e, and make room for it by dropping the least recently used */
+bool httpKeep(HttpEntry *e)
+{
+	HttpEntry **slot;
+
+	if(e->bodyLen + e->gzipLen > httpCacheLimit)
+		return false;
+
+	while(httpOldest != NULL && httpCacheLen + e->bodyLen + e->gzipLen > httpCacheLimit)
+		httpDrop(httpOldest);
+
+	slot = httpSlotOf(e->path, e->format);
+	e->chain = *slot;
+	*slot = e;
+
+	httpLink(e);
+	httpCacheLen += e->bodyLen + e->gzipLen;
+
+	return true;
+}
+
+/*------------------------------------------------------------------------------- */
+#ifdef HAVE_ZLIB
+/* Compress the body once, when rendered, rather than for each response */
+void httpGzip(HttpEntry *e)
+{
+	z_stream	zs;
+	bool		ok;
+
+	memset(&zs, 0, sizeof(zs));
+	if(deflateInit2(&zs, Z_DEFAULT_COMPRESSION, Z_DEFLATED, 15 + 16, 8, Z_DEFAULT_STRATEGY) != Z_OK)
+		return;
+
+	e->gzip = safe_malloc((int) deflateBound(&zs, e->bodyLen));
+	zs.next_in = (Bytef *) e->body;
+	zs.avail_in = e->bodyLen;
+	zs.next_out = (Bytef *) e->gzip;
+	zs.avail_out = (uInt) deflateBound(&zs, e->bodyLen);
+
+	ok = deflate(&zs, Z_FINISH) == Z_STREAM_END && zs.total_out < e->bodyLen;
+	e->gzipLen = ok ? (unsigned) zs.total_out : 0;
+	deflateEnd(&zs);
+
+	if(! ok)
+	{
+		free(e->gzip);
+		e->gzip = NULL;
 	}
 }
+#endif
 
 /*------------------------------------------------------------------------------- */
-void printCenterPara(ParaTable *parTab)
+/* Translate the document file to fmt in memory. A document that can't be */
+/* translated, for whatever reason, gives NULL and the server goes on */
+HttpEntry *httpRender(char *path, char *file, Format fmt, unsigned size, unsigned mtime)
 {
-	char lineBuf[512];
-	char *lineBufPtr;
-	int col;
-	int lastSpace;
-	char *lastSpacePtr;
-	int lastCol;
-	int maxWidth;
-	int lMarg;
-	int rMarg;
-	int leftPad;
-	bool newPageFlag;
-
-	/* calculate effective margins */
-
-	if(paraCount < 3)										/* header/footer margins seems to be garbage */
+	static PER_THREAD HttpEntry	*e;	/* static, so still known after longjmp() */
+	static PER_THREAD FILE		*fp, *out;
+	static PER_THREAD size_t	len;
+	jmp_buf						here;
+
+	overBudget = NULL;
+	e = NULL;
+	fp = out = NULL;
+	if(setjmp(here) != 0)
 	{
-		lMarg = 9;
-		rMarg = 79;
-		maxWidth = rMarg - lMarg;
+		if(fp != NULL)
+			fclose(fp);
+		if(out != NULL)
+			fclose(out);
+		if(e != NULL)
+			httpFree(e);
+		abandonDocument();
+		return NULL;
 	}
-	else
+	recovery = &here;
+
+	if((fp = fopen(file, "rb")) == NULL)
 	{
-		lMarg = parTab->leftMarg;
-		rMarg = parTab->rightMarg;
-		maxWidth = rMarg - lMarg;
+		recovery = NULL;
+		return NULL;
 	}
 
-	while(textBuffer[offset] != 0)							/* until end of paragraph, for each line */
+	if(! loadDocument(fp))
 	{
-		if(maxLines && lineNo >= maxLines)
-			newPage();
-
-		newPageFlag = false;
-		col = 0;
-		lastCol = 0;
-		lineBufPtr = lineBuf;
-		lastSpace = 0;
-		lastSpacePtr = NULL;
+		fclose(fp);
+		abandonDocument();
+		return NULL;
+	}
+	fclose(fp);
+	fp = NULL;
 
-		/* while within max line width, collect words and build line */
+	e = safe_malloc(sizeof(HttpEntry));
+	memset(e, 0, sizeof(HttpEntry));
+	e->path = safe_malloc((int) strlen(path) + 1);
+	strcpy(e->path, path);
+	e->format = fmt;
+	e->size = size;
+	e->mtime = mtime;
+	sprintf(e->etag, "\"%08x-%d-%d\"", documentHash(), fmt, encoding->id);
 
-		do {
-			if(textBuffer[offset] == FORM_FEED)
-				newPageFlag = true;
+	if((out = open_memstream(&e->body, &len)) == NULL)
+		error("quill-view: out of memory\n");
 
-			if(isPrintable(textBuffer[offset]) || textBuffer[offset] == TAB)
-				++col;					/* advance column  */
-			if(textBuffer[offset] == SPACE)
-			{
-				lastSpace = offset;							/* remember last space in case we need to break line */
-				lastSpacePtr = lineBufPtr;
-				lastCol = col;
-			}
+	rendererCount = 0;
+	addRenderer(fmt, out);
 
-			if(textBuffer[offset] == TAB)
-				*lineBufPtr++ = SPACE;						/* convert TAB to space in centered paras */
-			else
-				*lineBufPtr++ = textBuffer[offset];
-			++offset;
-		} while(textBuffer[offset] != END_PARA && col < maxWidth);
+	renderDocument(path);
 
-		*lineBufPtr = 0;
+	fclose(out);
+	out = NULL;
+	e->bodyLen = (unsigned) len;
+	unloadDocument();
 
-		if(col >= maxWidth && lastSpacePtr != NULL)			/* break line */
-		{
-			*lastSpacePtr = 0;								/* back up to last space */
-			offset = lastSpace;
-			col = lastCol;
-		}
+	if(overBudget != NULL)
+	{
+		recovery = NULL;
+		httpFree(e);
+		return NULL;
+	}
 
-		/* Center line */
-		leftPad = lMarg + (maxWidth / 2) - (col / 2);
-		renderMargin(leftPad);
-		renderLine(lineBuf);
+#ifdef HAVE_ZLIB
+	httpGzip(e);
+#endif
 
-		if(newPageFlag)
-			newPage();
-	}
+	recovery = NULL;
+	return e;
 }
 
 /*------------------------------------------------------------------------------- */
-void printPara(ParaTable *parTab)
+void httpWrite(int fd, char *data, unsigned len)
 {
-	++paraCount;
-
-	printf(renderParaStart);
+	ssize_t n;
 
-	if(textBuffer[offset] == 0)
-	{
-		if(paraCount > 2)
-			renderLine("");			/* empty paragaph needs a new line */
-	}
-	else
+	while(len > 0 && (n = write(fd, data, len)) > 0)
 	{
-		switch(parTab->justif)
-		{
-		case JUST_LEFT:
-			printLeftPara(parTab);
-			break;
-		case JUST_CENTRE:
-			printCenterPara(parTab);
-			break;
-		case JUST_RIGHT:
-			printRightPara(parTab);
-			break;
-		}
-		if(format == Html)
-		{
-			if(bold)	printf("</b>");
-			if(underline)	printf("</u>");
-			if(sub)		printf("</sub>");
-			if(super)	printf("</sup>");
-			bold = false;
-			sub = false;
-			super = false;
-			underline = false;
-		}
+		data += n;
+		len -= (unsigned) n;
 	}
-	printf(renderParaEnd);
 }
 
 /*------------------------------------------------------------------------------- */
-void *safe_malloc(int size)
+void httpReply(int fd, int status, char *reason, char *headers, char *body, unsigned len, bool head)
 {
-	void *p;
-	char msg[64];
+	char buf[1024];
+	int	 n;
 
-	p = malloc(size);
+	n = sprintf(buf, "HTTP/1.1 %d %s\r\nServer: %s\r\nConnection: close\r\n%.600s", status, reason, ME, headers);
+	if(status != 304)
+		n += sprintf(buf + n, "Content-Length: %u\r\n", len);
+	n += sprintf(buf + n, "\r\n");
 
-	if(p == NULL)
-	{
-		sprintf(msg, "quill-view: cant allocate %d bytes of memory\n", size);
-		error(msg);
-	}
-	return p;
+	httpWrite(fd, buf, n);
+	if(! head && status != 304)
+		httpWrite(fd, body, len);
 }
 
 /*------------------------------------------------------------------------------- */
-void translate(char *srcfile)
+void httpError(int fd, int status, char *reason, bool head)
 {
-	ParaTable	*currPara;
-	ParaTable	defaultPara = { 0, 0, 0, 9, 14, 69, 0, 0, 0 };
-	size_t	bytes;
-	int			i, ch, done;
-
-	/* Read 20 bytes header and make sure it's a Quill file  */
-
-	bytes = fread(&header, 1, HeaderSize, stdin);
-#ifndef _QDOS_
-	header.len = BEword(header.len);
-	header.textLen = BElong(header.textLen);
-	header.paraLen = BEword(header.paraLen);
-	header.freeLen = BEword(header.freeLen);
-	header.layoutLen = BEword(header.layoutLen);
-#endif
+	char body[128];
 
-	if(memcmp(header.id, "vrm1qdf0", sizeof(header.id)) != 0)
-		error("Not a valid Quill Document\n");
-
-	/* Read text buffer */
-
-	textBuffer = safe_malloc(header.textLen);
-	bytes = fread(textBuffer, 1, header.textLen, stdin);
-
-	/* goto paragraph table head and read it */
+	sprintf(body, "%d %s\n", status, reason);
+	httpReply(fd, status, reason, "Content-Type: text/plain\r\n", body, (unsigned) strlen(body), head);
+}
 
-	fseek(stdin, header.textLen, SEEK_SET);
-	bytes = fread(&parTableHead, 1, ParaTableHeadSize, stdin);
-#ifndef _QDOS_
-	parTableHead.size = BEword(parTableHead.size);
-	parTableHead.gran = BEword(parTableHead.gran);
-	parTableHead.used = BEword(parTableHead.used);
-	parTableHead.alloc = BEword(parTableHead.alloc);
-#endif
+/*------------------------------------------------------------------------------- */
+/* List the documents in the served directory, each a link to its translation */
+void httpIndex(int fd, bool head)
+{
+	struct dirent	*de;
+	DIR				*dp;
+	FILE			*out;
+	char			*body, *c;
+	size_t			len;
 
-	/* allocate memory and read the paragraph table (or, used parts actually), */
-	/* then translate from big to little endian */
+	if((dp = opendir(httpDir)) == NULL)
+	{
+		httpError(fd, 404, "Not Found", head);
+		return;
+	}
 
-	parTable = safe_malloc(parTableHead.size * parTableHead.used);
-	bytes = fread(parTable, 1, parTableHead.size * parTableHead.used, stdin);
+	if((out = open_memstream(&body, &len)) == NULL)
+		error("quill-view: out of memory\n");
 
-#ifndef _QDOS_
-	for(i = 0; i < parTableHead.used; ++i)
+	fprintf(out, "<html><head><title>%s</title><meta http-equiv=\"Content-Type\" content=\"text/html; charset=utf-8\" /></head>\n<body><ul>\n", ME);
+	while((de = readdir(dp)) != NULL)
 	{
-		parTable[i].offset = BElong(parTable[i].offset);
-		parTable[i].paraLen = BEword(parTable[i].paraLen);
+		if(de->d_name[0] == '.')
+			continue;
+
+		fputs("<li><a href=\"", out);
+		for(c = de->d_name; *c; ++c)
+			if(isalnum(*c) || strchr("-_.~", *c) != NULL)
+				putc(*c, out);
+			else
+				fprintf(out, "%%%02X", (byte) *c);
+		fputs("\">", out);
+		for(c = de->d_name; *c; ++c)
+			if(*c == '<' || *c == '>' || *c == '&')
+				fprintf(out, "&#%d;", *c);
+			else
+				putc(*c, out);
+		fputs("</a>\n", out);
 	}
-#endif
+	fputs("</ul></body></html>\n", out);
+	closedir(dp);
 
-	/* goto layout table head and read it */
+	fclose(out);
+	httpReply(fd, 200, "OK", "Content-Type: text/html; charset=utf-8\r\nCache-Control: no-cache\r\n", body, (unsigned) len, head);
+	free(body);
+}
 
-	fseek(stdin, header.textLen + header.freeLen + header.paraLen, SEEK_SET);
-	bytes = fread(&layoutTable, 1, LayoutTableSize, stdin);
-#ifndef _QDOS_
-	layoutTable.wordCount = BEword(layoutTable.wordCount);
-	layoutTable.maxTabSize = BEword(layoutTable.maxTabSize);
-	layoutTable.tabSize = BEword(layoutTable.tabSize);
-#endif
+/*------------------------------------------------------------------------------- */
+char *httpHeader(char *lines, char *name)	/* value of a request header, or "" */
+{
+	int len = (int) strlen(name);
 
-	/* allocate memory and read the tab entries table */
+	for(; *lines; lines += strlen(lines) + 1)
+		if(strncasecmp(lines, name, len) == 0 && lines[len] == ':')
+			return lines + len + 1;
 
-	tabTable = safe_malloc(layoutTable.tabSize);
-	bytes = fread(tabTable, 1, layoutTable.tabSize, stdin);
+	return "";
+}
 
-	/* rewind to start of text area, just after the 20 byte header */
+/*------------------------------------------------------------------------------- */
+char *httpCharset()
+{
+	switch(encoding->id)
+	{
+	case Latin1:	return "; charset=iso-8859-1";
+	case Cp1252:	return "; charset=windows-1252";
+	case Utf16le:	return "; charset=utf-16le";
+	case Ascii:		return "; charset=us-ascii";
+	case Native:	return "";
+	default:		return "; charset=utf-8";
+	}
+}
 
-	fseek(stdin, header.len, SEEK_SET);
-	offset = 0;
+/*------------------------------------------------------------------------------- */
+int hexDigit(int c)
+{
+	return isdigit(c) ? c - '0' : tolower(c) - 'a' + 10;
+}
 
-	/* and, finally, decode the actual text */
+/*------------------------------------------------------------------------------- */
+/* Answer a GET or HEAD of "/", the list of documents, or of "/name?format=x", */
+/* a document translated to text (default), html or json. Translations are */
+/* kept in memory until the document changes, and the response is empty if */
+/* the client has the translation already. */
+void httpRequest(int fd)
+{
+	char		req[HTTP_REQUEST + 1];
+	char		path[HTTP_REQUEST + 1];
+	char		file[MAX_PATH * 2 + 2];
+	char		headers[512];
+	char		memo[64] = "";
+	char		*target, *query, *lines, *end, *p, *q;
+	int			len = 0, n, hex;
+	unsigned	size, mtime;
+	bool		head, gzip, cached;
+	Format		fmt = format;
+	HttpEntry	*e;
+	struct stat	st;
+	double		start = traceNow();
+
+	req[0] = 0;
+	while((end = strstr(req, "\r\n\r\n")) == NULL)
+	{
+		if(len == HTTP_REQUEST || (n = (int) read(fd, req + len, HTTP_REQUEST - len)) <= 0)
+			return;
+		len += n;
+		req[len] = 0;
+	}
 
-	lineNo = 2;
-	pageNo = 1;
-	done = 0;
-	paraCount = 0;
+	/* request line, then a NULL terminated string for each header */
 
-	maxLines = layoutTable.pageLen - layoutTable.topMargin - layoutTable.bottomMarg;
-	if(layoutTable.pageLen == 0 || maxLines < 1)
-		maxLines = 0;		/* disable automatic page breaks */
-	else if(layoutTable.footerF)
-		maxLines -= 1;
+	for(p = q = req; p < end; ++p)
+		if(p[0] != '\r' || p[1] != '\n')
+			*q++ = *p;
+		else
+		{
+			*q++ = 0;
+			++p;
+		}
+	*q++ = 0;
+	*q = 0;
 
-	currPara = getPara(offset);
+	lines = req + strlen(req) + 1;
+	head = strncmp(req, "HEAD ", 5) == 0;
+	if(strncmp(req, "GET ", 4) != 0 && ! head)
+	{
+		httpError(fd, 405, "Method Not Allowed", false);
+		return;
+	}
 
-	/* get header  */
+	target = strchr(req, ' ') + 1;
+	if((p = strchr(target, ' ')) != NULL)
+		*p = 0;
+	if((query = strchr(target, '?')) != NULL)
+		*query++ = 0;
+
+	/* %xx is exactly two hex digits, for anything else the target is bad */
+	for(p = target, q = path, hex = 1; *p && hex != 0; ++p)
+		if(*p != '%')
+			*q++ = *p;
+		else if(isxdigit((unsigned char) p[1]) && isxdigit((unsigned char) p[2]))
+		{
+			hex = hexDigit(p[1]) * 16 + hexDigit(p[2]);
+			*q++ = (char) hex;
+			p += 2;
+		}
+		else
+			hex = 0;
+	*q = 0;
 
-	i = 0;
-	headerPara[0] = 0;
-	while(textBuffer[offset] != END_PARA)
-		headerPara[i++] = textBuffer[offset++];
-	++paraCount;
-	++offset;
+	if(hex == 0 || path[0] != '/' || strstr(path, "/..") != NULL)
+	{
+		httpError(fd, 400, "Bad Request", head);
+		return;
+	}
 
-	/* get footer */
+	if(strcmp(path, "/") == 0)
+	{
+		httpIndex(fd, head);
+		return;
+	}
 
-	i = 0;
-	footerPara[0] = 0;
-	while(textBuffer[offset] != END_PARA)
-		footerPara[i++] = textBuffer[offset++];
-	++offset;
-	++paraCount;
+	if(query != NULL && strstr(query, "format=") != NULL)
+	{
+		query = strstr(query, "format=") + 7;
+		if(strncmp(query, "html", 4) == 0)
+			fmt = Html;
+		else if(strncmp(query, "text", 4) == 0)
+			fmt = Text;
+		else if(strncmp(query, "json", 4) == 0)
+			fmt = Json;
+		else
+		{
+			httpError(fd, 400, "Bad Request", head);
+			return;
+		}
+	}
 
-	/* find out the smallest and largest margins in document, used for header/footer */
+	sprintf(file, "%.*s%.*s", MAX_PATH, httpDir, MAX_PATH, path);
+	if(stat(file, &st) != 0 || ! S_ISREG(st.st_mode))
+	{
+		httpError(fd, 404, "Not Found", head);
+		return;
+	}
+	size = (unsigned) st.st_size;
+	mtime = (unsigned) st.st_mtime;
+	traceDoc = path;
 
-	minLmarg = 100;
-	maxRmarg = 0;
+	/* translate the document unless it is cached and not changed since */
 
-	for(i = 3; i < parTableHead.used; ++i)					/* skip first entry (set *i = 1), always garbage? */
+	if((e = httpFind(path, fmt)) != NULL && (e->size != size || e->mtime != mtime))
 	{
-		minLmarg = min(parTable[i].leftMarg, minLmarg);
-		maxRmarg = max(parTable[i].rightMarg, maxRmarg);
+		httpDrop(e);
+		e = NULL;
 	}
 
-	if(format == Text)	/* Show text version */
+	if(e != NULL)
 	{
-#ifndef _QDOS_
-		putchar(0xEF);
-		putchar(0xBB);
-		putchar(0xBF);
-#endif
-		renderNewLine = "\n";
-		renderSpace = " ";
-		renderParaStart = "";
-		renderParaEnd = "";
+		httpUnlink(e);
+		httpLink(e);
+		cached = true;
 	}
+	else if((e = httpRender(path, file, fmt, size, mtime)) != NULL)
+		cached = httpKeep(e);
 	else
 	{
-		renderNewLine = "<br>\n";
-		renderSpace = "&nbsp;";
-		renderParaStart = "<p>";
-		renderParaEnd = "</p>";
-		printf(HTML_HEAD);
+		if(overBudget != NULL)
+			httpError(fd, 500, "Over Budget", head);
+		else
+			httpError(fd, 415, "Not a Quill Document", head);
+		return;
 	}
 
-	currPara = getPara(offset);
+	gzip = e->gzip != NULL && strstr(httpHeader(lines, "Accept-Encoding"), "gzip") != NULL;
 
-	if(currPara == NULL)
-		currPara = &defaultPara;
+	if(memoLimit > 0)
+		sprintf(memo, "X-Paragraph-Cache: %u/%u\r\n", memoHits, memoLookups);
 
-	while(! done)
-	{
-		printPara(currPara);
+	sprintf(headers, "Content-Type: %s%s\r\nETag: %s\r\nCache-Control: no-cache\r\n%s%s%s",
+		fmt == Html ? "text/html" : fmt == Text ? "text/plain" : "application/x-ndjson",
+		fmt == Text ? httpCharset() : "; charset=utf-8", e->etag,
+#ifdef HAVE_ZLIB
+		"Vary: Accept-Encoding\r\n",
+#else
+		"",
+#endif
+		gzip ? "Content-Encoding: gzip\r\n" : "", memo);
 
-		ch = getByte();
+	if(strstr(httpHeader(lines, "If-None-Match"), e->etag) != NULL)
+		httpReply(fd, 304, "Not Modified", headers, NULL, 0, head);
+	else if(gzip)
+		httpReply(fd, 200, "OK", headers, e->gzip, e->gzipLen, head);
+	else
+		httpReply(fd, 200, "OK", headers, e->body, e->bodyLen, head);
 
-		switch(ch)
-		{
-		case EOF:
-			done = true;
-			break;
-		case END_PARA:
-			{
-				ParaTable *newPara = getPara(offset);
-				currPara = newPara ? newPara : currPara;
-				break;
-			}
-		case END_TEXT:
-			done = 1;
-			break;
-		}
-	}
+	if(! cached)
+		httpFree(e);
 
-	if(format == Text)
+	traceSize = size;
+	traceSpan("request", start);
+	traceDoc = NULL;
+	if(traceFp != NULL)
 	{
-		fprintf(stdout, "\n\n____________________________________________________________________\n");
-		fprintf(stdout, "File: %s\nTranslated by %s (compiled %s)\n", srcfile, ME, __DATE__);
+		traceFlush();					/* the server runs until stopped */
+		fflush(traceFp);
 	}
-	else
+}
+
+/*------------------------------------------------------------------------------- */
+/* Serve the documents in dir on localhost, one request at a time */
+void serveHttp(char *dir, char *port)
+{
+	struct sockaddr_in	addr;
+	struct timeval		tv;
+	struct pollfd		pfd;
+	int					sock, fd, on = 1;
+
+	httpDir = dir;
+	pipelining = false;				/* the renderer process can't write to memory here */
+	signal(SIGPIPE, SIG_IGN);
+
+	memset(&addr, 0, sizeof(addr));
+	addr.sin_family = AF_INET;
+	addr.sin_port = htons((ushort) atoi(port));
+	addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+
+	if((sock = socket(AF_INET, SOCK_STREAM, 0)) < 0
+	|| setsockopt(sock, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on)) < 0
+	|| bind(sock, (struct sockaddr *) &addr, sizeof(addr)) < 0
+	|| listen(sock, 64) < 0)
+		io_error("quill-view: can't listen on port %s, '%s'\n", port);
+
+	fprintf(stderr, "quill-view: serving %s on http://127.0.0.1:%d/\n", dir, ntohs(addr.sin_port));
+
+	stopOnSignal();
+	pfd.fd = sock;
+	pfd.events = POLLIN;
+	while(! stopping)
 	{
-		char tmp[MAX_PATH + 64];
+		if(poll(&pfd, 1, -1) != 1 || (fd = accept(sock, NULL, NULL)) < 0)
+			continue;
 
-		printf(renderParaStart);
-		renderLine("_____________________________________________________________________________");
-		sprintf(tmp, "File: %s", srcfile);
-		renderLine(tmp);
-		sprintf(tmp, "Translated by %s (compiled %s)", ME, __DATE__);
-		printf(renderParaEnd);
+		tv.tv_sec = HTTP_TIMEOUT;	/* a client that stalls doesn't hold up the others for long */
+		tv.tv_usec = 0;
+		setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+		setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, &tv, sizeof(tv));
 
-		printf(HTML_TAIL);
+		httpRequest(fd);
+		close(fd);
 	}
+
+	close(sock);
 }
+#endif	/* HAVE_FORK */
 
 /*------------------------------------------------------------------------------- */
+#ifndef QV_NO_MAIN
 #ifdef _WIN32
 void fixFileName(char *fname)
 {
@@ -1238,6 +6273,8 @@ __stdcall WinMain(HINSTANCE inst, HINSTANCE pInst, LPSTR cmdLn, int show)
 	int			i;
 
 
+	setEncoding(DEFAULT_ENCODING);
+
 	/* build argc and argv manually - Win32 sucks... */
 
 	cmdLine = GetCommandLine();
@@ -1330,6 +6367,13 @@ __stdcall WinMain(HINSTANCE inst, HINSTANCE pInst, LPSTR cmdLn, int show)
 
 #else	/* if not _WIN32 */
 
+/* The exit status of main(), failing if the trace can't be written */
+int finish(int status)
+{
+	return traceClose() ? status : 1;
+}
+
+/*------------------------------------------------------------------------------- */
 int main(int argc, char *argv[])
 {
 	char		*sourceFile = "(stdin)";
@@ -1338,24 +6382,191 @@ int main(int argc, char *argv[])
 	int			i;
 
 	format = Text;
+	setEncoding(DEFAULT_ENCODING);
 	i = 1;
 
-	if(i < argc)
+	while(i < argc && argv[i][0] == '-')
 	{
 		if(strcmp(argv[i], "-h") == 0 || strcmp(argv[i], "--help") == 0)
 		{
 				usage();
 		}
-		else if(strcmp(argv[i], "-t") == 0)
+		else if(strcmp(argv[i], "-t") == 0 || strcmp(argv[i], "-m") == 0 || strcmp(argv[i], "-j") == 0)
+		{
+				format = argv[i][1] == 't' ? Text : argv[i][1] == 'm' ? Html : Json;
+
+				/* several formats, each with its own target file, translated in one go */
+
+				if(i + 1 < argc && (rendererCount > 0
+				|| (i + 2 < argc && (strcmp(argv[i + 2], "-t") == 0 || strcmp(argv[i + 2], "-m") == 0 || strcmp(argv[i + 2], "-j") == 0))))
+				{
+					if(rendererCount == MAX_RENDERERS)
+						usage();
+
+					fpout = fopen(argv[i + 1], "w");
+					if(fpout == NULL)
+						io_error("quill-view: can't open file %s, '%s'\n", argv[i + 1]);
+
+					addRenderer(format, fpout);
+					++i;
+				}
+				++i;
+		}
+		else if(strcmp(argv[i], "--index") == 0 && i + 2 < argc)
+		{
+				buildIndex(argv[i + 1], argc - i - 2, &argv[i + 2]);
+				return finish(0);
+		}
+		else if(strcmp(argv[i], "--query") == 0 && i + 2 < argc)
+		{
+				return finish(queryIndex(argv[i + 1], argc - i - 2, &argv[i + 2]) ? 0 : 1);
+		}
+		else if(strcmp(argv[i], "--grep") == 0 && i + 2 < argc)
+		{
+				if(strlen(argv[i + 1]) > MAX_PATTERN || (grepLen = utf8ToQL(argv[i + 1], grepPattern)) == 0)
+					usage();
+				return finish(runWorkers(&argv[i + 2], argc - i - 2, grepFile) ? 0 : 1);
+		}
+		else if(strcmp(argv[i], "--diff") == 0 && i + 3 == argc)
+		{
+				return finish(diffDocuments(argv[i + 1], argv[i + 2]));
+		}
+		else if(strcmp(argv[i], "--info") == 0 && (i + 1 < argc || packName != NULL))
+		{
+				char	**files;
+				int		count;
+
+				if(packName != NULL)
+					files = listPacked(&argv[i + 1], argc - i - 1, &count);
+				else
+					files = listFiles(&argv[i + 1], argc - i - 1, &count);
+				if(format != Json)
+					printf("file,valid,size,textLen,paragraphs,pageLength,wordCount,header,footer,tabSize\n");
+				return finish(runWorkers(files, count, packName != NULL ? infoPacked : infoFile) ? 0 : 1);
+		}
+		else if(strcmp(argv[i], "--batch") == 0 && (i + 2 < argc || (i + 1 < argc && packName != NULL)) && rendererCount == 0)
+		{
+				char	**files;
+				int		count;
+
+				batchDir = argv[i + 1];
+				if(packName == NULL)
+					return finish(runWorkers(&argv[i + 2], argc - i - 2, convertFile) ? 0 : 1);
+
+				files = listPacked(&argv[i + 2], argc - i - 2, &count);
+				return finish(runWorkers(files, count, convertPacked) ? 0 : 1);
+		}
+		else if(strcmp(argv[i], "--pack") == 0 && i + 2 < argc)
+		{
+				return finish(packDocuments(argv[i + 1], argc - i - 2, &argv[i + 2]) ? 0 : 1);
+		}
+		else if(strcmp(argv[i], "--packed") == 0 && i + 1 < argc)
+		{
+				openPack(argv[i + 1]);
+				i += 2;
+		}
+#ifdef HAVE_FORK
+		else if(strcmp(argv[i], "--http") == 0 && i + 2 == argc - 1 && rendererCount == 0)
+		{
+				serveHttp(argv[i + 2], argv[i + 1]);
+				return finish(0);
+		}
+		else if(strcmp(argv[i], "--http-cache") == 0 && i + 1 < argc)
+		{
+				httpCacheLimit = atoi(argv[i + 1]) * 1024;
+				i += 2;
+		}
+#endif
+#ifdef __linux__
+		else if(strcmp(argv[i], "--watch") == 0 && i + 2 == argc - 1 && rendererCount == 0)
+		{
+				batchDir = argv[i + 2];
+				watchDirectory(argv[i + 1]);
+				return finish(0);
+		}
+#endif
+		else if(strcmp(argv[i], "--jobs") == 0 && i + 1 < argc)
+		{
+				jobs = atoi(argv[i + 1]);
+				i += 2;
+		}
+		else if(strcmp(argv[i], "--para-cache") == 0 && i + 1 < argc)
+		{
+				memoLimit = atoi(argv[i + 1]) * 1024;
+				atexit(memoReport);
+				i += 2;
+		}
+		else if(strcmp(argv[i], "--max-lines") == 0 && i + 1 < argc)
+		{
+				budgetLines = atoi(argv[i + 1]);
+				i += 2;
+		}
+		else if(strcmp(argv[i], "--max-output") == 0 && i + 1 < argc)
+		{
+				budgetOutput = atoi(argv[i + 1]) * 1024;
+				i += 2;
+		}
+		else if(strcmp(argv[i], "--max-time") == 0 && i + 1 < argc)
+		{
+				budgetTime = atof(argv[i + 1]);
+				i += 2;
+		}
+		else if(strcmp(argv[i], "--cache") == 0 && i + 1 < argc)
+		{
+				cacheDir = argv[i + 1];
+				i += 2;
+		}
+		else if(strcmp(argv[i], "--encoding") == 0 && i + 1 < argc)
+		{
+				if(! setEncoding(argv[i + 1]))
+					usage();
+				i += 2;
+		}
+		else if(strcmp(argv[i], "--pages") == 0 && i + 1 < argc && rendererCount == 0 && paraFrom == 0)
 		{
-				format = Text;
+				pageDir = argv[i + 1];
+				i += 2;
+		}
+		else if(strcmp(argv[i], "--trace") == 0 && i + 1 < argc)
+		{
+				traceOpen(argv[i + 1]);
+				i += 2;
+		}
+		else if(strcmp(argv[i], "--paras") == 0 && i + 1 < argc && pageDir == NULL)
+		{
+				paraTo = 0x7fffffff;
+				switch(sscanf(argv[i + 1], "%d-%d", &paraFrom, &paraTo))
+				{
+				case 1:
+					if(argv[i + 1][strlen(argv[i + 1]) - 1] != '-')
+						paraTo = paraFrom;
+					break;
+				case 2:
+					break;
+				default:
+					usage();
+				}
+				if(paraFrom < 1 || paraTo < paraFrom)
+					usage();
+				i += 2;
+		}
+		else if(strcmp(argv[i], "--pipeline") == 0)
+		{
+				pipelining = true;
 				++i;
 		}
-		else if(strcmp(argv[i], "-m") == 0)
+		else if(strcmp(argv[i], "--stream") == 0)
 		{
-				format = Html;
+				streaming = true;
 				++i;
 		}
+		else if(strcmp(argv[i], "--arena-limit") == 0 && i + 1 < argc)
+		{
+				arenaLimit = atoi(argv[i + 1]) * 1024;
+				i += 2;
+		}
+		else
+				usage();
 	}
 
 	if(i < argc)
@@ -1371,6 +6582,9 @@ int main(int argc, char *argv[])
 
 	if(i < argc)
 	{
+		if(rendererCount > 0)
+			usage();						/* target files already given */
+
 		targetFile = argv[i];
 		fpout = freopen(targetFile, "w", stdout);
 		if(fpout == NULL)
@@ -1379,8 +6593,16 @@ int main(int argc, char *argv[])
 		++i;
 	}
 
-	translate(sourceFile);
+	if(paraFrom > 0)
+		excerpt(sourceFile);
+	else if(pageDir == NULL)
+		translate(sourceFile);
+	else if(format != Json)
+		splitPages(sourceFile);
+	else
+		usage();						/* JSON Lines has no pages */
 
-	return 0;
+	return finish(0);
 }
 #endif
+#endif	/* QV_NO_MAIN */
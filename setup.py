@@ -0,0 +1,12 @@
+# Builds the Python module quillview, see quill-view-python.c
+# python3 setup.py build_ext --inplace
+
+from setuptools import setup, Extension
+
+setup(
+	name="quillview",
+	version="0.8",
+	description="Translates Quill documents to Text, Html or JSON Lines",
+	ext_modules=[Extension("quillview", ["quill-view-python.c"],
+		depends=["quill-view.c"], extra_compile_args=["-funsigned-char"])],
+)
@@ -0,0 +1,473 @@
+#!/bin/sh
+#
+#	Runs quill-view on the sample documents in this directory and compares
+#	what it writes, stdout then stderr and the exit status, with the files in
+#	expected/. Run it with "make check", or from this directory as
+#
+#		./run-tests.sh [--update] [name...]
+#
+#	--update writes the expected files instead, check the changes to them
+#	before they are committed. The compile date in "Translated by" lines is
+#	left out, as are paths of the temporary directory.
+
+cd "`dirname "$0"`" || exit 1
+
+QV=${QV:-../quill-view}
+WORK=`mktemp -d "${TMPDIR:-/tmp}/qvtest.XXXXXX"` || exit 1
+trap 'rm -rf "$WORK"' 0
+trap 'exit 2' 1 2 15
+
+update=false
+if [ "$1" = "--update" ]; then
+	update=true
+	shift
+fi
+only="$*"
+passed=0
+failed=0
+skipped=0
+
+if [ ! -x "$QV" ]; then
+	echo "run-tests: $QV not found, build it first" >&2
+	exit 2
+fi
+
+# check name command [arg...]: runs the command, a program or a function of
+# this script, and compares its output with expected/name
+
+check()
+{
+	name=$1
+	shift
+
+	if [ -n "$only" ]; then
+		case " $only " in
+		*" $name "*) ;;
+		*) return ;;
+		esac
+	fi
+
+	rm -rf "$WORK/out"
+	mkdir "$WORK/out"
+	"$@" > "$WORK/result" 2> "$WORK/errors"
+	status=$?
+	cat "$WORK/errors" >> "$WORK/result"			# after stdout, as workers write it at the end
+	echo "exit $status" >> "$WORK/result"
+	sed -e 's/ (compiled [A-Z][a-z][a-z] [ 0-9][0-9] [0-9]*)//' -e "s|$WORK|WORK|g" "$WORK/result" > "$WORK/$name"
+
+	if $update; then
+		cp "$WORK/$name" "expected/$name"
+	elif [ ! -f "expected/$name" ]; then
+		echo "MISSING $name"
+		failed=`expr $failed + 1`
+	elif cmp -s "$WORK/$name" "expected/$name"; then
+		passed=`expr $passed + 1`
+	else
+		echo "FAIL $name"
+		diff "expected/$name" "$WORK/$name" | head -20
+		failed=`expr $failed + 1`
+	fi
+}
+
+# skip name reason: a test that can't run here
+
+skip()
+{
+	if [ -n "$only" ]; then
+		case " $only " in
+		*" $1 "*) ;;
+		*) return ;;
+		esac
+	fi
+
+	echo "skipped $1, $2"
+	skipped=`expr $skipped + 1`
+}
+
+# show file...: the files written by a test, each after its name and
+# followed by an empty line, as a file may not end with a newline
+
+show()
+{
+	for f in "$@"; do
+		echo "== `basename "$f"`"
+		cat "$f"
+		echo
+	done
+}
+
+#-------------------------------------------------------------------------------
+# Text and HTML of each sample
+
+for doc in ascii_doc ascii2_doc ascii4_doc fixme_doc ql2k_doc readme_doc tabs_doc; do
+	check $doc.txt "$QV" -t $doc
+	check $doc.html "$QV" -m $doc
+done
+
+#-------------------------------------------------------------------------------
+# Full-text index and query
+
+index()
+{
+	"$QV" --index "$WORK/out/idx" readme_doc tabs_doc ascii_doc || return
+	for words in "psion xchange" "dear ql user" "nosuchword"; do
+		echo "== $words"
+		"$QV" --query "$WORK/out/idx" $words
+	done
+}
+check index index
+
+#-------------------------------------------------------------------------------
+# Search of the text areas
+
+check grep "$QV" --jobs 2 --grep "QL user" readme_doc tabs_doc fixme_doc
+check grep-none "$QV" --grep "no such text" readme_doc tabs_doc
+
+#-------------------------------------------------------------------------------
+# Damaged headers, a text length far beyond the end of the file, and a
+# paragraph table with entries smaller than a paragraph, and the memory of
+# documents of different sizes, reused or given back between them. --info
+# finds valid the same documents as a translation, truncated ones too
+
+check badlen "$QV" badlen_doc
+check badpara "$QV" badpara_doc
+check badlen-info "$QV" --info badlen_doc badpara_doc truncated_doc
+
+arena()
+{
+	"$QV" --arena-limit 1 --batch "$WORK/out" readme_doc tabs_doc readme_doc ascii_doc || return
+	show "$WORK/out/tabs_doc.txt" "$WORK/out/ascii_doc.txt"
+	"$QV" -t readme_doc | cmp - "$WORK/out/readme_doc.txt"
+}
+check arena arena
+
+#-------------------------------------------------------------------------------
+# Several formats from one translation
+
+formats()
+{
+	"$QV" -t "$WORK/out/tabs.txt" -m "$WORK/out/tabs.html" -j "$WORK/out/tabs.jsonl" tabs_doc || return
+	show "$WORK/out/tabs.txt" "$WORK/out/tabs.html" "$WORK/out/tabs.jsonl"
+}
+check formats formats
+
+#-------------------------------------------------------------------------------
+# Layout cache, written by the first translation and replayed by the next,
+# and a damaged cache file that is laid out again
+
+cache()
+{
+	mkdir "$WORK/out/cache"
+	"$QV" -t readme_doc > "$WORK/out/plain.txt"
+	"$QV" -m readme_doc > "$WORK/out/plain.html"
+	for run in write replay; do
+		"$QV" --cache "$WORK/out/cache" -t readme_doc | cmp - "$WORK/out/plain.txt" && echo "$run text same"
+		"$QV" --cache "$WORK/out/cache" -m readme_doc | cmp - "$WORK/out/plain.html" && echo "$run html same"
+	done
+	ls "$WORK/out/cache" | wc -l | tr -d ' '
+	for f in "$WORK/out/cache"/*; do
+		head -c 100 "$f" > "$WORK/out/part" && mv "$WORK/out/part" "$f"
+	done
+	"$QV" --cache "$WORK/out/cache" -t readme_doc | cmp - "$WORK/out/plain.txt" && echo "damaged cache text same"
+}
+check cache cache
+
+#-------------------------------------------------------------------------------
+# Batches, to a directory by two workers, and to stdout as one stream,
+# with a file that is not there and one that is not a document
+
+batch()
+{
+	"$QV" --jobs 2 --batch "$WORK/out" ascii_doc tabs_doc nosuch_doc badlen_doc ql2k_doc
+	echo "exit $?"
+	ls "$WORK/out"
+	show "$WORK/out/tabs_doc.txt"
+}
+check batch batch
+check batch-stream "$QV" -j --jobs 2 --batch - tabs_doc ascii_doc
+
+#-------------------------------------------------------------------------------
+# Linux: documents in a directory translated at start, and when written, until
+# stopped, which ends the trace
+
+watch()
+{
+	mkdir "$WORK/out/src" "$WORK/out/dst"
+	cp tabs_doc ascii_doc "$WORK/out/src"
+	"$QV" -t readme_doc | grep -v "^File: " > "$WORK/out/plain.txt"
+	"$QV" --trace "$WORK/out/trace.json" --watch "$WORK/out/src" "$WORK/out/dst" &
+	pid=$!
+
+	for i in 1 2 3 4 5 6 7 8 9 10; do
+		[ -f "$WORK/out/dst/ascii_doc.txt" ] && [ -f "$WORK/out/dst/tabs_doc.txt" ] && break
+		sleep 1
+	done
+	cp readme_doc "$WORK/out/src/new_doc"
+	for i in 1 2 3 4 5 6 7 8 9 10; do
+		sleep 1
+		[ -f "$WORK/out/dst/new_doc.txt" ] && grep -v "^File: " "$WORK/out/dst/new_doc.txt" | cmp -s - "$WORK/out/plain.txt" && break
+	done
+
+	kill $pid
+	wait $pid
+	echo "stopped, exit $?"
+	ls "$WORK/out/dst"
+	grep -v "^File: " "$WORK/out/dst/new_doc.txt" | cmp - "$WORK/out/plain.txt" && echo "new_doc translated"
+	grep -c '"name":"write"' "$WORK/out/trace.json"
+	tail -1 "$WORK/out/trace.json"
+}
+if [ "`uname`" = Linux ]; then
+	check watch watch
+else
+	skip watch "--watch is for Linux"
+fi
+
+#-------------------------------------------------------------------------------
+# An edited document, laid out again with the paragraphs of the earlier
+# version from the layout cache, comes out as when laid out from scratch
+
+edited()
+{
+	mkdir "$WORK/out/cache"
+	cp readme_doc "$WORK/out/doc"
+	"$QV" --cache "$WORK/out/cache" "$WORK/out/doc" > "$WORK/out/old.txt"
+	cp edited_doc "$WORK/out/doc"
+	"$QV" --cache "$WORK/out/cache" "$WORK/out/doc" > "$WORK/out/new.txt"
+	"$QV" "$WORK/out/doc" | cmp - "$WORK/out/new.txt" && echo "edited same"
+	"$QV" --cache "$WORK/out/cache" -m "$WORK/out/doc" > "$WORK/out/new.html"
+	"$QV" -m "$WORK/out/doc" | cmp - "$WORK/out/new.html" && echo "edited html same"
+	diff "$WORK/out/old.txt" "$WORK/out/new.txt"
+}
+check edited edited
+
+#-------------------------------------------------------------------------------
+# Streamed translation, the same as with the document in memory
+
+stream()
+{
+	for fmt in -t -m -j; do
+		for doc in readme_doc ql2k_doc tabs_doc; do
+			"$QV" $fmt $doc > "$WORK/out/plain"
+			"$QV" --stream $fmt $doc | cmp - "$WORK/out/plain" && echo "$fmt $doc same"
+		done
+	done
+}
+check stream stream
+check stream-damaged "$QV" --stream badlen_doc
+
+#-------------------------------------------------------------------------------
+# JSON Lines, a record per paragraph
+
+for doc in ql2k_doc fixme_doc tabs_doc; do
+	check $doc.jsonl "$QV" -j $doc
+done
+
+#-------------------------------------------------------------------------------
+# Text in other encodings, of the paragraphs only, as the "Translated by"
+# line can't be left out of UTF-16
+
+for enc in latin-1 cp1252 utf-16le ascii ql; do
+	check ascii_doc.$enc "$QV" --encoding $enc --paras 1- ascii_doc
+done
+
+#-------------------------------------------------------------------------------
+# Layout and rendering in two processes, the same as in one
+
+pipeline()
+{
+	for fmt in -t -m -j; do
+		"$QV" $fmt readme_doc > "$WORK/out/plain"
+		"$QV" --pipeline $fmt readme_doc | cmp - "$WORK/out/plain" && echo "$fmt readme_doc same"
+	done
+}
+check pipeline pipeline
+
+#-------------------------------------------------------------------------------
+# The Python module, when it has been built
+
+if ls ../quillview*.so > /dev/null 2>&1 && command -v python3 > /dev/null; then
+	check python python3 test-python.py "$QV"
+else
+	skip python "the module is not built, see make python"
+fi
+
+#-------------------------------------------------------------------------------
+# A file for each page, by two workers, and their index
+
+pages()
+{
+	for fmt in -t -m; do
+		rm -rf "$WORK/out/pages"
+		mkdir "$WORK/out/pages"
+		"$QV" $fmt --jobs 2 --pages "$WORK/out/pages" readme_doc || return
+		ls "$WORK/out/pages"
+	done
+	show "$WORK/out/pages/index.html" "$WORK/out/pages/page-0002.html"
+	rm -rf "$WORK/out/pages"
+	mkdir "$WORK/out/pages"
+	"$QV" -t --pages "$WORK/out/pages" tabs_doc
+	show "$WORK/out/pages"/*
+}
+check pages pages
+
+#-------------------------------------------------------------------------------
+# The tables of many documents, as CSV and JSON Lines, by two workers
+
+samples="ascii_doc ascii2_doc ascii4_doc fixme_doc ql2k_doc readme_doc tabs_doc edited_doc badlen_doc nosuch_doc"
+check info "$QV" --jobs 2 --info $samples
+check info.jsonl "$QV" -j --jobs 2 --info $samples
+
+#-------------------------------------------------------------------------------
+# The HTTP server, with curl: the start of translations, a damaged document
+# that is answered 415 while the server goes on, bad targets, and an ETag.
+# Stopped, the server ends the trace
+
+http()
+{
+	mkdir "$WORK/out/srv"
+	cp tabs_doc badlen_doc "$WORK/out/srv"
+	port=`expr 20000 + $$ % 10000`
+	"$QV" --trace "$WORK/out/trace.json" --http $port "$WORK/out/srv" 2> "$WORK/out/server" &
+	pid=$!
+	url=http://127.0.0.1:$port
+
+	for i in 1 2 3 4 5 6 7 8 9 10; do
+		curl -s -o /dev/null "$url/" && break
+		sleep 1
+	done
+
+	for target in "/tabs_doc" "/tabs_doc?format=html" "/tabs_doc?format=json" "/badlen_doc" "/tabs_doc" \
+			"/nosuch_doc" "/tabs%5fdoc" "/tabs_doc%2" "/%zztabs_doc" "/%-1tabs_doc" "/tabs%00_doc" "/../tabs_doc"; do
+		curl -s --path-as-is -o "$WORK/out/body" -D "$WORK/out/head" "$url$target"
+		echo "== $target"
+		sed -n -e 's/\r$//' -e '1p' -e '/^ETag:/p' -e '/^Content-Type:/p' "$WORK/out/head"
+		head -3 "$WORK/out/body"
+		echo
+	done
+	curl -s --path-as-is -o /dev/null -D "$WORK/out/head" "$url/tabs_doc"
+	etag=`sed -n -e 's/\r$//' -e 's/^ETag: //p' "$WORK/out/head"`
+	echo "== /tabs_doc, If-None-Match"
+	curl -s -o /dev/null -w "%{http_code}\n" -H "If-None-Match: $etag" "$url/tabs_doc"
+
+	kill $pid
+	wait $pid
+	echo "stopped, exit $?"
+	sed "s/:$port/:PORT/" "$WORK/out/server"
+	grep -c '"name":"request"' "$WORK/out/trace.json"
+	tail -1 "$WORK/out/trace.json"
+}
+if command -v curl > /dev/null; then
+	check http http
+else
+	skip http "curl is not there"
+fi
+
+#-------------------------------------------------------------------------------
+# Paragraph by paragraph comparison of two documents
+
+check diff "$QV" --diff readme_doc edited_doc
+check diff-same "$QV" --diff readme_doc readme_doc
+check diff-damaged "$QV" --diff readme_doc badlen_doc
+
+#-------------------------------------------------------------------------------
+# Timeline of a batch by two workers, without the times and process id, and
+# a trace that can't be written, which fails at the end
+
+trace()
+{
+	"$QV" --trace "$WORK/out/trace.json" --jobs 2 --batch "$WORK/out" tabs_doc ascii_doc readme_doc || return
+	sed -e 's/"pid":[0-9]*/"pid":0/' -e 's/"ts":[0-9.]*,"dur":[0-9.]*/"ts":0,"dur":0/' "$WORK/out/trace.json"
+}
+check trace trace
+if [ -w /dev/full ]; then
+	check trace-full "$QV" --trace /dev/full tabs_doc
+else
+	skip trace-full "/dev/full is not there"
+fi
+
+#-------------------------------------------------------------------------------
+# Ranges of paragraphs, in each format, to the end, and out of range
+
+check paras "$QV" --paras 3-5 readme_doc
+check paras.html "$QV" -m --paras 3-5 readme_doc
+check paras.jsonl "$QV" -j --paras 3-4 readme_doc
+check paras-end "$QV" --paras 148- readme_doc
+check paras-beyond "$QV" --paras 500-600 readme_doc
+
+#-------------------------------------------------------------------------------
+# A container of documents, listed, and translated as when each is a file
+
+pack()
+{
+	"$QV" --pack "$WORK/out/docs.qvp" tabs_doc ascii_doc readme_doc badlen_doc || return
+	"$QV" --packed "$WORK/out/docs.qvp" --info
+	mkdir "$WORK/out/batch"
+	"$QV" --jobs 2 --packed "$WORK/out/docs.qvp" --batch "$WORK/out/batch"
+	ls "$WORK/out/batch"
+	for doc in tabs_doc ascii_doc readme_doc; do
+		"$QV" -t $doc | cmp - "$WORK/out/batch/$doc.txt" && echo "$doc same"
+	done
+	"$QV" -j tabs_doc > "$WORK/out/tabs.jsonl"
+	"$QV" -j --packed "$WORK/out/docs.qvp" --batch - tabs_doc nosuch_doc | cmp - "$WORK/out/tabs.jsonl" && echo "tabs_doc json same"
+}
+check pack pack
+
+#-------------------------------------------------------------------------------
+# Paragraph cache, over documents that share paragraphs, in one process and
+# by two workers, coming out as without it
+
+paracache()
+{
+	docs="readme_doc edited_doc readme_doc tabs_doc edited_doc readme_doc"
+	for doc in $docs; do
+		"$QV" -t $doc
+	done > "$WORK/out/plain"
+	"$QV" --para-cache 1024 --jobs 1 --batch - $docs | cmp - "$WORK/out/plain" && echo "one process same"
+	"$QV" --para-cache 1024 --jobs 2 --batch - $docs | cmp - "$WORK/out/plain" && echo "two workers same"
+}
+check para-cache paracache
+
+#-------------------------------------------------------------------------------
+# Documents that hung the layout before: tab tables of zero and one byte,
+# and a centred paragraph narrower than its words. With timeout, when it is
+# there, so that a hang is a failure rather than the end of the tests
+
+limited()
+{
+	if command -v timeout > /dev/null; then
+		timeout 20 "$@"
+	else
+		"$@"
+	fi
+}
+
+for doc in zerotab_doc oddtab_doc narrow_doc; do
+	check $doc.txt limited "$QV" -t $doc
+done
+check narrow_doc.html limited "$QV" -m narrow_doc
+
+# Budgets of each document of a batch, the one over it is reported and its
+# target removed. truncated_doc is readme_doc cut in half, read as if the
+# rest were zeros
+
+budget()
+{
+	limited "$QV" --max-lines 100 --batch "$WORK/out" readme_doc tabs_doc truncated_doc
+	ls "$WORK/out"
+	rm -f "$WORK/out"/*
+	limited "$QV" --max-output 4 --jobs 2 --batch "$WORK/out" tabs_doc readme_doc ascii_doc
+	ls "$WORK/out"
+	"$QV" -t readme_doc > "$WORK/out/plain"
+	limited "$QV" --max-time 600 --max-lines 100000 --max-output 100000 --batch - readme_doc | cmp - "$WORK/out/plain" && echo "within budgets same"
+}
+check budget budget
+check budget.jsonl limited "$QV" -j --max-lines 100 --batch - tabs_doc readme_doc
+
+#-------------------------------------------------------------------------------
+
+if $update; then
+	echo "expected files written, $skipped skipped"
+	exit 0
+fi
+echo "$passed passed, $failed failed, $skipped skipped"
+[ $failed = 0 ]
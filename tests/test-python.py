@@ -0,0 +1,82 @@
+#
+#	Tests of the Python module quillview, run by run-tests.sh when it has
+#	been built with "make python". The translations are compared with
+#	those of quill-view, without the "Translated by" line.
+#
+#		python3 test-python.py quill-view
+#
+
+import subprocess
+import sys
+import threading
+
+sys.path.insert(0, "..")
+import quillview
+
+qv = sys.argv[1]
+
+def same(a, b):
+	return [l for l in a.splitlines() if "Translated by" not in l] == [l for l in b.splitlines() if "Translated by" not in l]
+
+def program(*args):
+	return subprocess.run([qv] + list(args), stdout=subprocess.PIPE, check=True).stdout
+
+def read(name):
+	with open(name, "rb") as f:
+		return f.read()
+
+for doc in ("readme_doc", "ql2k_doc", "tabs_doc"):
+	data = read(doc)
+	print(doc, "text", same(quillview.translate(data, name=doc), program("-t", doc).decode("utf-8-sig")))
+	print(doc, "html", same(quillview.translate(data, "html", name=doc), program("-m", doc).decode("utf-8")))
+	print(doc, "json", same(quillview.translate(data, "json", name=doc), program("-j", doc).decode("utf-8")))
+	print(doc, "latin-1", same(quillview.translate(data, "text", "latin-1", doc).decode("latin-1"),
+		program("--encoding", "latin-1", doc).decode("latin-1")))
+
+info = quillview.info(read("readme_doc"))
+for key in sorted(info):
+	print(key, info[key])
+
+# damaged documents, and wrong arguments, raise ValueError
+
+for doc in ("badlen_doc", "badpara_doc"):
+	for call in (quillview.translate, quillview.info):
+		try:
+			call(read(doc))
+			print(doc, call.__name__, "translated")
+		except ValueError as e:
+			print(doc, call.__name__, "ValueError:", e)
+
+for args in ((b"",), (b"x" * 30,), (read("tabs_doc"), "pdf"), (read("tabs_doc"), "text", "ebcdic")):
+	try:
+		quillview.translate(*args)
+		print(args[1:], "translated")
+	except ValueError as e:
+		print(args[1:], "ValueError:", e)
+
+# threads translate side by side, each with its own converter state, and
+# each gets its own translation whatever the others translate meanwhile
+
+docs = ("readme_doc", "ql2k_doc", "tabs_doc", "ascii_doc")
+calls = [(doc, fmt, enc) for doc in docs for fmt in ("text", "html", "json") for enc in (None, "latin-1")]
+wanted = dict((call, quillview.translate(read(call[0]), call[1], call[2], call[0])) for call in calls)
+infos = dict((doc, quillview.info(read(doc))) for doc in docs)
+wrong = []
+
+def work(n):
+	for i in range(20):
+		call = calls[(n * 7 + i) % len(calls)]
+		if quillview.translate(read(call[0]), call[1], call[2], call[0]) != wanted[call]:
+			wrong.append(call)
+		if quillview.info(read(call[0])) != infos[call[0]]:
+			wrong.append(call)
+
+threads = [threading.Thread(target=work, args=(n,)) for n in range(8)]
+for t in threads:
+	t.start()
+for t in threads:
+	t.join()
+print("threads", len(threads), "wrong", len(wrong))
+
+for doc in docs:
+	print(doc, "thread", same(wanted[(doc, "text", None)], program("-t", doc).decode("utf-8-sig")))